@@ -74,10 +74,13 @@ typedef struct {
   uint8_t* front_fb;
   /// The "back" framebuffer object.
   uint8_t* back_fb;
-  /// Buffer for holding the interlaced difference image.
+  /// Buffer for holding the interlaced difference image, NULL until the first difference update.
   uint8_t* difference_fb;
   /// Tainted lines based on the last difference calculation.
   bool* dirty_lines;
+  /// The back framebuffer holds the image on the display,
+  /// so updates can drive only the pixels that change.
+  bool back_fb_valid;
   /// The waveform information to use.
   const EpdWaveform* waveform;
 } EpdiyHighlevelState;
@@ -85,8 +88,8 @@ typedef struct {
 
 /**
  * Initialize a state object.
- * This allocates two framebuffers and an update buffer for
- * the display in the external PSRAM.
+ * This allocates two framebuffers for the display in the external PSRAM.
+ * The buffer for difference images is allocated by the first update that draws one.
  * In order to keep things simple, a chip reset is triggered if this fails.
  *
  * @param waveform: The waveform to use for updates.
@@ -109,6 +112,8 @@ uint8_t* epd_hl_get_framebuffer(EpdiyHighlevelState* state);
  * 		Additional mode settings like the framebuffer format or
  * 		previous display state are determined by the driver and must not be supplied here.
  * 		In most cases, one of `MODE_GC16` and `MODE_GL16` should be used.
+ * 		`MODE_GC16` drives every pixel. Non-flashing modes like `MODE_GL16` only drive
+ * 		the pixels that differ from the back framebuffer, once it holds the displayed image.
  * @param temperature: Environmental temperature of the display in °C.
  * @returns `EPD_DRAW_SUCCESS` on sucess, a combination of error flags otherwise.
  */
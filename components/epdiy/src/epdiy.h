@@ -30,11 +30,13 @@ typedef struct {
 enum EpdInitOptions {
     /// Use the default options.
     EPD_OPTIONS_DEFAULT = 0,
-    /// Use a small look-up table of 1024 bytes.
+    /// Use a small look-up table of 512 bytes, recalculated for every frame.
     /// The EPD driver will use less space, but performance may be worse.
     EPD_LUT_1K = 1,
     /// Use a 64K lookup table. (default)
-    /// Best performance, but permanently occupies a 64k block of internal memory.
+    /// The tables for the next frame are prepared while the current frame is output,
+    /// so this permanently occupies two 64k blocks of internal memory.
+    /// Best performance.
     EPD_LUT_64K = 2,
 
     /// Use a small feed queue of 8 display lines.
@@ -43,6 +45,9 @@ enum EpdInitOptions {
     /// Use a feed queue of 32 display lines. (default)
     /// Best performance, but larger memory footprint.
     EPD_FEED_QUEUE_32 = 8,
+    /// Look up every pixel in the waveform table directly, without a lookup table.
+    /// This is the reference implementation, mostly useful for comparison.
+    EPD_LUT_DIRECT = 16,
 };
 
 /// The image drawing mode.
@@ -96,11 +101,19 @@ enum EpdDrawMode {
   /// must add a padding nibble per line.
   MODE_PACKING_2PPB = 0x80,
   /// A difference image with one pixel per byte.
-  /// The upper nibble marks the "from" color,
-  /// the lower nibble the "to" color.
+  /// The upper nibble marks the "to" color,
+  /// the lower nibble the "from" color, see `epd_difference_image()`.
   MODE_PACKING_1PPB_DIFFERENCE = 0x100,
   // reserver for 4PPB mode
 
+  /// 4 bit-per-pixel framebuffer transposed into four 1-bit planes,
+  /// see `epd_pack_bitplanes()`. Rows are padded to a multiple of 32 pixels.
+  MODE_PACKING_4PLANES = 0x800,
+
+  /// Clear the rows of the update with the clear frames of the waveform
+  /// at its start, in the same drive sequence.
+  MODE_CLEAR_FIRST = 0x1000,
+
   /// Assert that the display has a uniform color, e.g. after initialization.
   /// If `MODE_PACKING_2PPB` is specified, a optimized output calculation can be used.
   /// Draw on a white background
@@ -521,6 +534,102 @@ EpdRect epd_difference_image_cropped(
  */
 EpdRect epd_difference_image(const uint8_t* to, const uint8_t* from, uint8_t* interlaced, bool* dirty_lines);
 
+/**
+ * Convert a `MODE_PACKING_2PPB` framebuffer in place to `MODE_PACKING_4PLANES`.
+ * Every block of 32 pixels (16 bytes) is transposed into one 32 bit word per
+ * bit plane, so a frame can be calculated with a few bitwise operations per block.
+ * Afterwards, the buffer must be drawn with `MODE_PACKING_4PLANES`.
+ *
+ * @param framebuffer: A word aligned 4-bpp framebuffer.
+ * @param width: The framebuffer width, must be a multiple of 32.
+ * @param height: The framebuffer height.
+ */
+void epd_pack_bitplanes(uint8_t* framebuffer, int width, int height);
+
+/**
+ * Find the shades used in a `MODE_PACKING_2PPB` framebuffer.
+ *
+ * @returns A mask with bit `s` set if shade `s` occurs in the image,
+ *      to be passed to `epd_set_shade_mask()`.
+ */
+uint16_t epd_shade_mask(const uint8_t* framebuffer, int width, int height);
+
+/**
+ * Restrict the next draw to the shades in `shade_mask` (see `epd_shade_mask()`).
+ * Waveform frames that do nothing for all of these shades are skipped.
+ * Only applies to the next call of `epd_draw_base()`, which resets it to all shades.
+ */
+void epd_set_shade_mask(uint16_t shade_mask);
+
+/**
+ * Draw rows `[y, y + height)` with the waveform of `mode` (e.g. `MODE_DU` for a clock strip)
+ * in the next call of `epd_draw_base()`, while the other rows use the mode of the draw.
+ * Both waveforms run in the same frames with the line times of the draw,
+ * the rows of the shorter one are output as no-ops after it ended.
+ * The waveform of `mode` comes from the waveform container, without a table for it
+ * the rows are drawn like the rest. All regions of a draw share one mode.
+ * Not available with `MODE_PACKING_4PLANES`.
+ * Only applies to the next call of `epd_draw_base()`.
+ */
+void epd_set_region_mode(int y, int height, enum EpdDrawMode mode);
+
+/**
+ * Number of line chunks the render threads took over from each other
+ * during the last draw, because one of them fell behind.
+ */
+int epd_chunks_stolen();
+
+/// Waveform frames with an individual output time in `EpdRenderStats`.
+#define EPD_STATS_FRAMES 32
+/// Render threads with individual counters in `EpdRenderStats`.
+#define EPD_STATS_THREADS 2
+
+/// Measurements of the render path during the last draw, see `epd_render_stats()`.
+typedef struct {
+    /// Duration of the whole draw in us.
+    uint32_t draw_time_us;
+    /// Duration of the clear frames in us, see `MODE_CLEAR_FIRST`.
+    uint32_t clear_time_us;
+    /// Output time of each waveform frame in us, 0 for frames that were skipped.
+    uint32_t frame_time_us[EPD_STATS_FRAMES];
+    /// Number of waveform frames that were output.
+    int frames;
+    /// Lines calculated by each render thread.
+    uint32_t lines_rendered[EPD_STATS_THREADS];
+    /// Busy-wait iterations of each render thread for a free output slot.
+    uint32_t slot_wait_spins[EPD_STATS_THREADS];
+    /// Lines each render thread dropped because their output slot was not released in time.
+    uint32_t slot_timeouts[EPD_STATS_THREADS];
+    /// Busy-wait iterations of each render thread for prefetched framebuffer rows.
+    uint32_t fetch_wait_spins[EPD_STATS_THREADS];
+    /// Line chunks each render thread took over from a thread that fell behind.
+    uint32_t chunks_stolen[EPD_STATS_THREADS];
+    /// Fewest lines ready ahead of the output, -1 if never measured.
+    int min_lines_ahead;
+    /// Number of line group interrupts of the output.
+    uint32_t eof_interrupts;
+    /// Longest line group interrupt in CPU cycles.
+    uint32_t eof_max_cycles;
+    /// Lines output as no-ops because they were not ready in time.
+    uint32_t missed_lines;
+    /// Frames driven again for the lines they missed.
+    int redrives;
+} EpdRenderStats;
+
+/**
+ * Render path measurements of the last draw.
+ * Valid until the next draw starts.
+ */
+const EpdRenderStats* epd_render_stats();
+
+/**
+ * Set a function called with `true` when the output missed lines during a draw,
+ * so the application can reduce its load (e.g. Wi-Fi) for the rest of it,
+ * and with `false` when that draw is done.
+ * The pixel clock is stepped down for the rest of the draw as well.
+ */
+void epd_set_underrun_cb(void (*cb)(bool relieve));
+
 /**
  * Return the pixel color of a 4 bit image array
  * x,y coordinates of the image pixel
@@ -4,7 +4,9 @@
 
 #include "epd_highlevel.h"
 #include "epdiy.h"
+#include "output_common/lut.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <esp_heap_caps.h>
 #include <esp_log.h>
@@ -21,6 +23,48 @@
 
 static bool already_initialized = 0;
 
+static inline int min(int x, int y) { return x < y ? x : y; }
+static inline int max(int x, int y) { return x > y ? x : y; }
+
+/// Modes that leave unchanged pixels alone, so they are drawn from a difference image.
+static bool is_difference_mode(enum EpdDrawMode mode) {
+  switch (mode & MODE_UNKNOWN_WAVEFORM) {
+    case MODE_DU:
+    case MODE_A2:
+    case MODE_GL16:
+    case MODE_GL16_FAST:
+    case MODE_DU4:
+    case MODE_GL4:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Copy the pixels of `area` between two 4-bpp framebuffers of the display size.
+static void copy_area(uint8_t* dst, const uint8_t* src, EpdRect area) {
+  int x0 = max(area.x, 0);
+  int x1 = min(area.x + area.width, epd_width());
+  int y1 = min(area.y + area.height, epd_height());
+
+  for (int y = max(area.y, 0); y < y1 && x0 < x1; y++) {
+    uint8_t* d = dst + y * epd_width() / 2;
+    const uint8_t* s = src + y * epd_width() / 2;
+    // odd pixels are in the upper nibble
+    if (x0 % 2) {
+      d[x0 / 2] = (d[x0 / 2] & 0x0F) | (s[x0 / 2] & 0xF0);
+    }
+    int first = (x0 + 1) / 2;
+    int end = x1 / 2;
+    if (end > first) {
+      memcpy(d + first, s + first, end - first);
+    }
+    if (x1 % 2) {
+      d[x1 / 2] = (d[x1 / 2] & 0xF0) | (s[x1 / 2] & 0x0F);
+    }
+  }
+}
+
 EpdiyHighlevelState epd_hl_init(const EpdWaveform* waveform) {
   assert(!already_initialized);
 
@@ -31,12 +75,22 @@ EpdiyHighlevelState epd_hl_init(const EpdWaveform* waveform) {
   #endif
   EpdiyHighlevelState state;
 
-  state.front_fb = heap_caps_malloc(fb_size, MALLOC_CAP_SPIRAM);
+  // rows are fetched by DMA, which needs 16 byte aligned PSRAM addresses
+  state.front_fb = heap_caps_aligned_alloc(16, fb_size, MALLOC_CAP_SPIRAM);
   assert(state.front_fb != NULL);
 
+  state.back_fb = heap_caps_aligned_alloc(16, fb_size, MALLOC_CAP_SPIRAM);
+  assert(state.back_fb != NULL);
+  // allocated by the first difference update
+  state.difference_fb = NULL;
+  state.dirty_lines = malloc(epd_height() * sizeof(bool));
+  assert(state.dirty_lines != NULL);
   state.waveform = waveform;
 
   memset(state.front_fb, 0xFF, fb_size);
+  memset(state.back_fb, 0xFF, fb_size);
+  // the display content is unknown until the first full update
+  state.back_fb_valid = false;
   already_initialized = true;
   return state;
 
@@ -52,13 +106,56 @@ enum EpdDrawError epd_hl_update_screen(EpdiyHighlevelState* state, enum EpdDrawM
   return epd_hl_update_area(state, mode, temperature, epd_full_screen());
 }
 
+/// The difference image takes twice the size of a framebuffer,
+/// it is only allocated once an update can use it.
+static bool alloc_difference_fb(EpdiyHighlevelState* state) {
+  if (state->difference_fb == NULL) {
+    // one byte per pixel, rows are fetched by DMA as well
+    state->difference_fb = heap_caps_aligned_alloc(16, epd_width() * epd_height(), MALLOC_CAP_SPIRAM);
+    if (state->difference_fb == NULL) {
+      ESP_LOGW("EPDiy", "could not allocate the difference image, drawing the whole area.");
+    }
+  }
+  return state->difference_fb != NULL;
+}
+
 enum EpdDrawError epd_hl_update_area(EpdiyHighlevelState* state, enum EpdDrawMode mode, int temperature, EpdRect area) {
   assert(state != NULL);
   
   uint32_t t1 = esp_timer_get_time() / 1000;
   enum EpdDrawError err;
 
-  err = epd_draw_base(epd_full_screen(), state->front_fb, area, MODE_PACKING_2PPB | PREVIOUSLY_WHITE | mode, temperature, state->dirty_lines, state->waveform);
+  // Without a transition table, changed pixels would be driven as if they were white.
+  bool difference = state->back_fb_valid && is_difference_mode(mode)
+      && !(mode & (MODE_PACKING_4PLANES | MODE_CLEAR_FIRST))
+      && mode_has_transitions(mode, waveform_temp_range(temperature))
+      && alloc_difference_fb(state);
+  if (difference) {
+    // only the pixels that change are driven, with their (from, to) transition
+    EpdRect changed = epd_difference_image_cropped(state->front_fb, state->back_fb, area,
+                                                   state->difference_fb, state->dirty_lines, NULL, NULL);
+    if (changed.width == 0 || changed.height == 0) {
+      return EPD_DRAW_SUCCESS;
+    }
+    err = epd_draw_base(epd_full_screen(), state->difference_fb, changed, MODE_PACKING_1PPB_DIFFERENCE | mode, temperature, state->dirty_lines, state->waveform);
+    area = changed;
+  } else {
+    // the framebuffer is 4-bpp unless it was converted to bit planes
+    enum EpdDrawMode packing = (mode & MODE_PACKING_4PLANES) ? 0 : MODE_PACKING_2PPB;
+    err = epd_draw_base(epd_full_screen(), state->front_fb, area, packing | PREVIOUSLY_WHITE | mode, temperature, NULL, state->waveform);
+  }
+
+  // Bit planes can't be compared, and after an error the display content is uncertain.
+  // Otherwise the back framebuffer follows the display.
+  EpdRect screen = epd_full_screen();
+  bool full_screen = area.x <= 0 && area.y <= 0
+      && area.x + area.width >= screen.width && area.y + area.height >= screen.height;
+  if (err != EPD_DRAW_SUCCESS || (mode & MODE_PACKING_4PLANES)) {
+    state->back_fb_valid = false;
+  } else if (state->back_fb_valid || full_screen) {
+    copy_area(state->back_fb, state->front_fb, area);
+    state->back_fb_valid = true;
+  }
 
   uint32_t t2 = esp_timer_get_time() / 1000;
   printf("actual draw took %dms.\n", t2 - t1);
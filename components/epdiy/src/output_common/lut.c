@@ -10,35 +10,303 @@
 #include "esp_log.h"
 #include "esp_partition.h"
 #include "esp_err.h"
+#include "esp_rom_crc.h"
+#include "esp_heap_caps.h"
+#include <stddef.h>
 
 #define IMAGES_PARTITION_LABEL "images"
 #define WAVEFORM_OFFSET 0x45E000
 
 static const char *TAG = "waveform_flash";
 
-uint8_t custom_wave[16][30] = {
-  {2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0}, //0
-  {2, 0, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0, 1, 1, 1, 1, 1, 0}, //1
-  {2, 0, 1, 1, 1, 1, 0, 1, 1, 1, 1, 0, 2, 0, 1, 1, 1, 0}, //2
-  {2, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 0, 1, 1, 0, 2, 1, 0}, //3
-    
-  {2, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 0, 2, 0}, //4
-  {2, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 0, 2, 0}, //5
-  {2, 2, 2, 2, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0}, //6
-  {2, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0}, //7
-
-  {2, 2, 2, 2, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 2, 0}, //8
-  {2, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0, 2, 0}, //9
-  {2, 0, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 2, 0}, //10
-  {2, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 0, 2, 2, 0}, //11
-
-  {2, 2, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 0, 2, 2, 0, 2, 0}, //12
-  {2, 0, 2, 0, 2, 2, 2, 0, 1, 1, 1, 0, 0, 2, 2, 0, 2, 0}, //13
-  {2, 0, 2, 2, 2, 2, 2, 2, 0, 1, 1, 0, 2, 2, 0, 2, 2, 0}, //14
-  {2, 0, 2, 2, 2, 2, 2, 2, 2, 2, 0, 2, 2, 2, 2, 2, 2, 0}, //15
-};
-
-void save_waveform() {
+// Every temperature range has a sector of its own behind the default waveform,
+// holding the waveform, the 16 bit frame times and the clear sequence.
+#define WAVEFORM_SECTOR_SIZE 0x1000
+// the waveform container follows the sectors of the temperature ranges
+#define WAVEFORM_CONTAINER_OFFSET (WAVEFORM_OFFSET + (WAVEFORM_TEMP_RANGES + 1) * WAVEFORM_SECTOR_SIZE)
+
+// waveform used until one is stored
+#define BUILTIN_WAVE { \
+  {2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0}, /* 0 */ \
+  {2, 0, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0, 1, 1, 1, 1, 1, 0}, /* 1 */ \
+  {2, 0, 1, 1, 1, 1, 0, 1, 1, 1, 1, 0, 2, 0, 1, 1, 1, 0}, /* 2 */ \
+  {2, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 0, 1, 1, 0, 2, 1, 0}, /* 3 */ \
+ \
+  {2, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 0, 2, 0}, /* 4 */ \
+  {2, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 0, 2, 0}, /* 5 */ \
+  {2, 2, 2, 2, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0}, /* 6 */ \
+  {2, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0}, /* 7 */ \
+ \
+  {2, 2, 2, 2, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 2, 0}, /* 8 */ \
+  {2, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 0, 2, 0}, /* 9 */ \
+  {2, 0, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 2, 2, 0}, /* 10 */ \
+  {2, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 1, 1, 0, 2, 2, 0}, /* 11 */ \
+ \
+  {2, 2, 2, 2, 2, 0, 1, 1, 1, 1, 1, 1, 0, 2, 2, 0, 2, 0}, /* 12 */ \
+  {2, 0, 2, 0, 2, 2, 2, 0, 1, 1, 1, 0, 0, 2, 2, 0, 2, 0}, /* 13 */ \
+  {2, 0, 2, 2, 2, 2, 2, 2, 0, 1, 1, 0, 2, 2, 0, 2, 2, 0}, /* 14 */ \
+  {2, 0, 2, 2, 2, 2, 2, 2, 2, 2, 0, 2, 2, 2, 2, 2, 2, 0}, /* 15 */ \
+}
+
+static const uint8_t builtin_wave[SHADES][FRAMES] = BUILTIN_WAVE;
+uint8_t custom_wave[SHADES][FRAMES] = BUILTIN_WAVE;
+
+int frame_times[FRAMES] = {0};
+uint8_t region_wave[SHADES][FRAMES];
+
+// darken, lighten, then let the particles settle
+#define BUILTIN_CLEAR_WAVE { \
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, \
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, \
+  0, 0, 0, 0, 0, CLEAR_WAVE_END, \
+}
+
+static const uint8_t builtin_clear_wave[CLEAR_FRAMES] = BUILTIN_CLEAR_WAVE;
+uint8_t clear_wave[CLEAR_FRAMES] = BUILTIN_CLEAR_WAVE;
+int clear_frame_count = 25;
+
+FrameInfo frame_info[FRAMES];
+int waveform_first_frame = 0;
+int waveform_end_frame = FRAMES;
+
+void analyze_waveform() {
+    int counts[3] = {0};
+
+    for (int f = 0; f < FRAMES; f++) {
+        FrameInfo *info = &frame_info[f];
+        info->low_op = custom_wave[0][f];
+        info->high_op = custom_wave[SHADES - 1][f];
+        info->threshold = SHADES;
+
+        // with a single change of op between neighbouring shades,
+        // the frame is a threshold split.
+        int changes = 0;
+        for (int s = 1; s < SHADES; s++) {
+            if (custom_wave[s][f] != custom_wave[s - 1][f]) {
+                changes++;
+                info->threshold = s;
+            }
+        }
+
+        if (changes == 0) {
+            info->kind = FRAME_UNIFORM;
+            info->threshold = 0;
+        } else if (changes == 1) {
+            info->kind = FRAME_BINARY;
+        } else {
+            info->kind = FRAME_GENERAL;
+        }
+        counts[info->kind]++;
+    }
+
+    // trim no-op frames at both ends
+    waveform_first_frame = 0;
+    waveform_end_frame = FRAMES;
+    while (waveform_end_frame > 0 && frame_info[waveform_end_frame - 1].kind == FRAME_UNIFORM
+           && frame_info[waveform_end_frame - 1].low_op == 0) {
+        waveform_end_frame--;
+    }
+    while (waveform_first_frame < waveform_end_frame && frame_info[waveform_first_frame].kind == FRAME_UNIFORM
+           && frame_info[waveform_first_frame].low_op == 0) {
+        waveform_first_frame++;
+    }
+
+    ESP_LOGI(TAG, "Waveform frames: %d uniform, %d binary, %d general, driving frames %d to %d",
+             counts[FRAME_UNIFORM], counts[FRAME_BINARY], counts[FRAME_GENERAL],
+             waveform_first_frame, waveform_end_frame - 1);
+}
+
+/// Frames of `wave` in which any of the shades in `shade_mask` is driven.
+static uint32_t wave_frame_mask(uint8_t wave[SHADES][FRAMES], uint16_t shade_mask) {
+    uint32_t mask = 0;
+    for (int f = 0; f < FRAMES; f++) {
+        for (int s = 0; s < SHADES; s++) {
+            if ((shade_mask & (1 << s)) && wave[s][f]) {
+                mask |= 1 << f;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+uint32_t waveform_frame_mask(uint16_t shade_mask) {
+    return wave_frame_mask(custom_wave, shade_mask);
+}
+
+bool set_clear_wave(const uint8_t *ops) {
+    int count = 0;
+    while (count < CLEAR_FRAMES && ops[count] != CLEAR_WAVE_END) {
+        if (ops[count] > 2) {
+            return false;
+        }
+        count++;
+    }
+    memcpy(clear_wave, ops, count);
+    if (count < CLEAR_FRAMES) {
+        clear_wave[count] = CLEAR_WAVE_END;
+    }
+    clear_frame_count = count;
+    return true;
+}
+
+/// Layout of the waveform cache, increase when it changes.
+#define WAVEFORM_CACHE_VERSION 2
+
+/// The waveform of a temperature range.
+typedef struct {
+    uint32_t version;
+    /// stored for the range itself, not taken over from the default waveform
+    uint32_t own;
+    uint8_t wave[SHADES][FRAMES];
+    uint16_t times[FRAMES];
+    uint8_t clear_ops[CLEAR_FRAMES];
+    uint32_t crc;
+} WaveformCache;
+
+// per temperature range, the default waveform first.
+// Survives deep sleep, so waking up needs no flash read.
+RTC_NOINIT_ATTR static WaveformCache waveform_cache[WAVEFORM_TEMP_RANGES + 1];
+// range of the waveform in the globals since this boot, see `load_waveform()`
+static int active_range = WAVEFORM_NO_RANGE;
+// container table in the globals instead, see `load_mode_waveform()`
+static const WaveformTableEntry *active_table = NULL;
+
+// stored container, read once per boot. NULL if there is none.
+static uint8_t *waveform_container = NULL;
+static bool waveform_container_read = false;
+
+// lowest temperature of each range, the first one is open to colder temperatures
+const int waveform_temp_min[WAVEFORM_TEMP_RANGES] = {-128, 10, 18, 26};
+
+int waveform_temp_range(int temperature) {
+    int range = 0;
+    while (range < WAVEFORM_TEMP_RANGES - 1 && temperature >= waveform_temp_min[range + 1]) {
+        range++;
+    }
+    return range;
+}
+
+static inline WaveformCache *cache_of(int range) {
+    return &waveform_cache[range + 1];
+}
+
+/// Flash sector of a range, the default waveform keeps its original place.
+static inline uint32_t waveform_offset(int range) {
+    return WAVEFORM_OFFSET + (range + 1) * WAVEFORM_SECTOR_SIZE;
+}
+
+static uint32_t waveform_cache_crc(const WaveformCache *cache) {
+    return esp_rom_crc32_le(0, (const uint8_t *)cache, offsetof(WaveformCache, crc));
+}
+
+static bool waveform_cache_valid(const WaveformCache *cache) {
+    return cache->version == WAVEFORM_CACHE_VERSION
+        && cache->crc == waveform_cache_crc(cache);
+}
+
+/// Take over the waveform globals into `cache`.
+static void fill_waveform_cache(WaveformCache *cache, bool own) {
+    memset(cache, 0, sizeof(WaveformCache));
+    cache->version = WAVEFORM_CACHE_VERSION;
+    cache->own = own;
+    memcpy(cache->wave, custom_wave, WAVEFORM_SIZE);
+    for (int f = 0; f < FRAMES; f++) {
+        cache->times[f] = frame_times[f];
+    }
+    memset(cache->clear_ops, CLEAR_WAVE_END, CLEAR_FRAMES);
+    memcpy(cache->clear_ops, clear_wave, clear_frame_count);
+    cache->crc = waveform_cache_crc(cache);
+}
+
+/// Set the waveform globals from `cache`.
+static void apply_waveform_cache(const WaveformCache *cache) {
+    memcpy(custom_wave, cache->wave, WAVEFORM_SIZE);
+    for (int f = 0; f < FRAMES; f++) {
+        frame_times[f] = cache->times[f];
+    }
+    set_clear_wave(cache->clear_ops);
+    analyze_waveform();
+}
+
+/**
+ * Read the waveform globals of `range` from flash and cache them.
+ * Ranges without a stored waveform use the default one,
+ * which falls back to the built-in waveform.
+ */
+static void read_waveform_flash(int range) {
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, IMAGES_PARTITION_LABEL);
+
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Failed to find the images partition!");
+        return;
+    }
+
+    uint32_t offset = waveform_offset(range);
+    uint8_t wave[SHADES][FRAMES];
+    esp_err_t err = esp_partition_read(partition, offset, wave, WAVEFORM_SIZE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read waveform data from flash: %s", esp_err_to_name(err));
+        return;
+    }
+
+    // erased flash, nothing was stored for the range
+    bool stored = true;
+    for (int i = 0; i < WAVEFORM_SIZE; i++) {
+        stored &= wave[i / FRAMES][i % FRAMES] <= 2;
+    }
+    if (!stored) {
+        if (range != WAVEFORM_DEFAULT_RANGE) {
+            load_waveform(WAVEFORM_DEFAULT_RANGE);
+        } else {
+            memcpy(custom_wave, builtin_wave, WAVEFORM_SIZE);
+            memset(frame_times, 0, sizeof(frame_times));
+            set_clear_wave(builtin_clear_wave);
+            analyze_waveform();
+        }
+        fill_waveform_cache(cache_of(range), false);
+        return;
+    }
+    ESP_LOGI(TAG, "Waveform data of range %d read successfully from flash!", range);
+    memcpy(custom_wave, wave, WAVEFORM_SIZE);
+
+    uint16_t times[FRAMES];
+    err = esp_partition_read(partition, offset + WAVEFORM_SIZE, times, sizeof(times));
+    for (int f = 0; f < FRAMES; f++) {
+        // erased flash from before frame times were stored
+        frame_times[f] = (err != ESP_OK || times[f] == 0xFFFF) ? 0 : times[f];
+    }
+
+    // erased flash is rejected, keeping the current clear sequence
+    uint8_t clear_ops[CLEAR_FRAMES];
+    if (esp_partition_read(partition, offset + WAVEFORM_SIZE + sizeof(times), clear_ops, CLEAR_FRAMES) == ESP_OK) {
+        set_clear_wave(clear_ops);
+    }
+    analyze_waveform();
+    fill_waveform_cache(cache_of(range), true);
+}
+
+void save_waveform(int range) {
+    WaveformCache incoming;
+    fill_waveform_cache(&incoming, true);
+
+    // compare with the waveform the range uses now
+    if (!waveform_cache_valid(cache_of(range))) {
+        read_waveform_flash(range);
+    }
+    apply_waveform_cache(&incoming);
+    active_range = range;
+    active_table = NULL;
+    const WaveformCache *current = cache_of(range);
+    if (waveform_cache_valid(current)
+            && memcmp(incoming.wave, current->wave, WAVEFORM_SIZE) == 0
+            && memcmp(incoming.times, current->times, sizeof(incoming.times)) == 0
+            && memcmp(incoming.clear_ops, current->clear_ops, CLEAR_FRAMES) == 0) {
+        ESP_LOGI(TAG, "Waveform of range %d unchanged, flash is not written", range);
+        return;
+    }
+
     const esp_partition_t *partition = esp_partition_find_first(
         ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, IMAGES_PARTITION_LABEL);
 
@@ -47,23 +315,56 @@ void save_waveform() {
         return;
     }
 
+    // whatever happens now, flash may no longer match the cache
+    cache_of(range)->version = 0;
+    if (range == WAVEFORM_DEFAULT_RANGE) {
+        // ranges without their own waveform use the new default
+        for (int r = 0; r < WAVEFORM_TEMP_RANGES; r++) {
+            if (!cache_of(r)->own) {
+                cache_of(r)->version = 0;
+            }
+        }
+    }
+
     // Erase the sector before writing
-    esp_err_t err = esp_partition_erase_range(partition, WAVEFORM_OFFSET, 4096);
+    uint32_t offset = waveform_offset(range);
+    esp_err_t err = esp_partition_erase_range(partition, offset, WAVEFORM_SECTOR_SIZE);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to erase flash region: %s", esp_err_to_name(err));
         return;
     }
 
     // Write the waveform data to flash
-    err = esp_partition_write(partition, WAVEFORM_OFFSET, custom_wave, WAVEFORM_SIZE);
+    err = esp_partition_write(partition, offset, incoming.wave, WAVEFORM_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, offset + WAVEFORM_SIZE, incoming.times, sizeof(incoming.times));
+    }
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, offset + WAVEFORM_SIZE + sizeof(incoming.times), incoming.clear_ops, CLEAR_FRAMES);
+    }
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to write waveform data to flash: %s", esp_err_to_name(err));
     } else {
-        ESP_LOGI(TAG, "Waveform data written successfully to flash!");
+        *cache_of(range) = incoming;
+        ESP_LOGI(TAG, "Waveform data of range %d written successfully to flash!", range);
     }
 }
 
-void load_waveform() {
+void forget_waveform(int range) {
+    // the built-in waveform is no replacement for the default one
+    if (range == WAVEFORM_DEFAULT_RANGE) {
+        return;
+    }
+    if (!waveform_cache_valid(cache_of(range))) {
+        // fills the cache through the globals, the next load applies the right ones again
+        read_waveform_flash(range);
+        active_range = WAVEFORM_NO_RANGE;
+        active_table = NULL;
+    }
+    if (!cache_of(range)->own) {
+        return;
+    }
+
     const esp_partition_t *partition = esp_partition_find_first(
         ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, IMAGES_PARTITION_LABEL);
 
@@ -72,20 +373,320 @@ void load_waveform() {
         return;
     }
 
-    esp_err_t err = esp_partition_read(partition, WAVEFORM_OFFSET, custom_wave, WAVEFORM_SIZE);
+    // read again on the next load, which then falls back to the default waveform
+    cache_of(range)->version = 0;
+    if (active_range == range) {
+        active_range = WAVEFORM_NO_RANGE;
+    }
+    esp_err_t err = esp_partition_erase_range(partition, waveform_offset(range), WAVEFORM_SECTOR_SIZE);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to read waveform data from flash: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to erase flash region: %s", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG, "Waveform of range %d removed, it uses the default one", range);
+}
+
+void load_waveform(int range) {
+    if (range == active_range) {
+        return;
+    }
+
+    // only cold boots and corrupted caches read the flash
+    if (waveform_cache_valid(cache_of(range))) {
+        apply_waveform_cache(cache_of(range));
     } else {
-        ESP_LOGI(TAG, "Waveform data read successfully from flash!");
+        read_waveform_flash(range);
+    }
+    active_range = range;
+    active_table = NULL;
+}
+
+/**
+ * Check the CRC and the table directory of a container of `size` bytes.
+ */
+static bool waveform_container_valid(const uint8_t *data, size_t size) {
+    const WaveformContainerHeader *header = (const WaveformContainerHeader *)data;
+    if (size < sizeof(WaveformContainerHeader)
+            || header->magic != WAVEFORM_CONTAINER_MAGIC
+            || header->version != WAVEFORM_CONTAINER_VERSION
+            || header->size != size
+            || sizeof(WaveformContainerHeader) + header->table_count * sizeof(WaveformTableEntry) > size) {
+        return false;
+    }
+    if (header->crc != esp_rom_crc32_le(0, data + sizeof(WaveformContainerHeader), size - sizeof(WaveformContainerHeader))) {
+        return false;
+    }
+
+    const WaveformTableEntry *tables = (const WaveformTableEntry *)(data + sizeof(WaveformContainerHeader));
+    for (int t = 0; t < header->table_count; t++) {
+        const WaveformTableEntry *table = &tables[t];
+        size_t op_count = (table->flags & WAVEFORM_TABLE_TRANSITIONS ? SHADES * SHADES : SHADES) * table->frames;
+        size_t table_size = op_count;
+        if (table->flags & WAVEFORM_TABLE_TIMES) {
+            table_size += 2 * table->frames;
+        }
+        if (table->frames == 0 || table->frames > FRAMES
+                || (table->range >= WAVEFORM_TEMP_RANGES && table->range != WAVEFORM_ANY_RANGE)
+                || table->offset > size || table_size > size - table->offset) {
+            return false;
+        }
+        for (int i = 0; i < op_count; i++) {
+            if (data[table->offset + i] > 2) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// The stored container, NULL if there is none.
+static const uint8_t *get_waveform_container() {
+    if (waveform_container_read) {
+        return waveform_container;
+    }
+    waveform_container_read = true;
+
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, IMAGES_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Failed to find the images partition!");
+        return NULL;
+    }
+
+    WaveformContainerHeader header;
+    if (esp_partition_read(partition, WAVEFORM_CONTAINER_OFFSET, &header, sizeof(header)) != ESP_OK
+            || header.magic != WAVEFORM_CONTAINER_MAGIC
+            || header.size > WAVEFORM_CONTAINER_MAX_SIZE) {
+        // nothing stored, every mode uses the waveform of its temperature range
+        return NULL;
+    }
+
+    uint8_t *data = heap_caps_malloc(header.size, MALLOC_CAP_8BIT);
+    if (data == NULL) {
+        ESP_LOGE(TAG, "No memory for the waveform container");
+        return NULL;
+    }
+    if (esp_partition_read(partition, WAVEFORM_CONTAINER_OFFSET, data, header.size) != ESP_OK
+            || !waveform_container_valid(data, header.size)) {
+        ESP_LOGE(TAG, "Stored waveform container is corrupted");
+        heap_caps_free(data);
+        return NULL;
+    }
+    waveform_container = data;
+    return waveform_container;
+}
+
+/**
+ * Table of the container for `mode` and the temperature `range`,
+ * a table for all ranges if there is none for `range`.
+ */
+static const WaveformTableEntry *find_waveform_table(int mode, int range) {
+    const uint8_t *data = get_waveform_container();
+    if (data == NULL) {
+        return NULL;
+    }
+
+    const WaveformContainerHeader *header = (const WaveformContainerHeader *)data;
+    const WaveformTableEntry *tables = (const WaveformTableEntry *)(data + sizeof(WaveformContainerHeader));
+    const WaveformTableEntry *any_range = NULL;
+    for (int t = 0; t < header->table_count; t++) {
+        if (tables[t].mode != mode) {
+            continue;
+        }
+        if (tables[t].range == range) {
+            return &tables[t];
+        }
+        if (tables[t].range == WAVEFORM_ANY_RANGE && any_range == NULL) {
+            any_range = &tables[t];
+        }
     }
+    return any_range;
+}
+
+/// Copy the ops per shade of a container table into `wave`.
+/// For transition tables, these are the transitions from white.
+static void copy_table_ops(const WaveformTableEntry *table, uint8_t wave[SHADES][FRAMES]) {
+    const uint8_t *ops = waveform_container + table->offset;
+    if (table->flags & WAVEFORM_TABLE_TRANSITIONS) {
+        ops += (SHADES - 1) * SHADES * table->frames;
+    }
+
+    memset(wave, 0, WAVEFORM_SIZE);
+    for (int s = 0; s < SHADES; s++) {
+        memcpy(wave[s], ops + s * table->frames, table->frames);
+    }
+}
+
+/// Set the waveform globals from a container table, the clear sequence stays.
+static void apply_waveform_table(const WaveformTableEntry *table) {
+    int op_count = (table->flags & WAVEFORM_TABLE_TRANSITIONS ? SHADES * SHADES : SHADES) * table->frames;
+    const uint8_t *times = waveform_container + table->offset + op_count;
+
+    copy_table_ops(table, custom_wave);
+    for (int f = 0; f < FRAMES; f++) {
+        frame_times[f] = 0;
+        if (f < table->frames && (table->flags & WAVEFORM_TABLE_TIMES)) {
+            frame_times[f] = times[2 * f] | (times[2 * f + 1] << 8);
+        }
+    }
+    analyze_waveform();
+}
+
+void load_mode_waveform(enum EpdDrawMode mode, int range) {
+    const WaveformTableEntry *table = find_waveform_table(mode & 0x3F, range);
+    if (table == NULL) {
+        load_waveform(range);
+        return;
+    }
+    if (table != active_table) {
+        apply_waveform_table(table);
+        active_table = table;
+        active_range = WAVEFORM_NO_RANGE;
+    }
+}
+
+bool mode_has_transitions(enum EpdDrawMode mode, int range) {
+    const WaveformTableEntry *table = find_waveform_table(mode & 0x3F, range);
+    return table != NULL && (table->flags & WAVEFORM_TABLE_TRANSITIONS);
+}
+
+bool load_region_waveform(enum EpdDrawMode mode, int range) {
+    const WaveformTableEntry *table = find_waveform_table(mode & 0x3F, range);
+    if (table == NULL) {
+        return false;
+    }
+    copy_table_ops(table, region_wave);
+    return true;
+}
+
+uint32_t region_frame_mask(uint16_t shade_mask) {
+    return wave_frame_mask(region_wave, shade_mask);
+}
+
+void calculate_region_lut(uint8_t *lut, int frame, bool difference) {
+    if (!difference) {
+        // as `calculate_lut_1k()`
+        for (int i = 0; i < 256; i++) {
+            uint8_t ops = region_wave[i & 0x0F][frame] | (region_wave[i >> 4][frame] << 2);
+            lut[i] = ops;
+            lut[i + 256] = ops << 4;
+        }
+        return;
+    }
+
+    // as `calculate_difference_lut()`, by new shade
+    for (int to = 0; to < SHADES; to++) {
+        for (int from = 0; from < SHADES; from++) {
+            uint8_t op = from == to ? 0 : region_wave[to][frame];
+            int index = (to << 4) | from;
+            for (int p = 0; p < 4; p++) {
+                lut[p * 256 + index] = op << (2 * p);
+            }
+        }
+    }
+}
+
+/// Ops of the active transition table, NULL if the active waveform has none.
+static const uint8_t *active_transitions() {
+    if (active_table == NULL || !(active_table->flags & WAVEFORM_TABLE_TRANSITIONS)) {
+        return NULL;
+    }
+    return waveform_container + active_table->offset;
+}
+
+uint32_t transition_frame_mask() {
+    const uint8_t *transitions = active_transitions();
+    if (transitions == NULL) {
+        return waveform_frame_mask(ALL_SHADES);
+    }
+
+    int frames = active_table->frames;
+    uint32_t mask = 0;
+    for (int from = 0; from < SHADES; from++) {
+        for (int to = 0; to < SHADES; to++) {
+            if (from == to) {
+                continue;
+            }
+            const uint8_t *ops = transitions + (from * SHADES + to) * frames;
+            for (int f = 0; f < frames; f++) {
+                if (ops[f] != 0) {
+                    mask |= 1 << f;
+                }
+            }
+        }
+    }
+    return mask;
+}
+
+void calculate_difference_lut(uint8_t *lut, int frame) {
+    const uint8_t *transitions = active_transitions();
+
+    for (int to = 0; to < SHADES; to++) {
+        for (int from = 0; from < SHADES; from++) {
+            uint8_t op = 0;
+            if (from == to) {
+                // non-flashing: unchanged pixels are left alone
+            } else if (transitions == NULL) {
+                op = custom_wave[to][frame];
+            } else if (frame < active_table->frames) {
+                op = transitions[(from * SHADES + to) * active_table->frames + frame];
+            }
+
+            int index = (to << 4) | from;
+            for (int p = 0; p < 4; p++) {
+                lut[p * 256 + index] = op << (2 * p);
+            }
+        }
+    }
+}
+
+bool store_waveform_container(const uint8_t *data, size_t size) {
+    if (size > WAVEFORM_CONTAINER_MAX_SIZE || !waveform_container_valid(data, size)) {
+        ESP_LOGE(TAG, "Invalid waveform container of %d bytes", (int)size);
+        return false;
+    }
+
+    const uint8_t *stored = get_waveform_container();
+    if (stored != NULL && ((const WaveformContainerHeader *)stored)->size == size && memcmp(stored, data, size) == 0) {
+        ESP_LOGI(TAG, "Waveform container unchanged, flash is not written");
+        return true;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, IMAGES_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Failed to find the images partition!");
+        return false;
+    }
+
+    // tables of the old container are no longer valid
+    heap_caps_free(waveform_container);
+    waveform_container = NULL;
+    waveform_container_read = false;
+    if (active_table != NULL) {
+        active_table = NULL;
+        active_range = WAVEFORM_NO_RANGE;
+    }
+
+    size_t erase_size = (size + WAVEFORM_SECTOR_SIZE - 1) / WAVEFORM_SECTOR_SIZE * WAVEFORM_SECTOR_SIZE;
+    esp_err_t err = esp_partition_erase_range(partition, WAVEFORM_CONTAINER_OFFSET, erase_size);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, WAVEFORM_CONTAINER_OFFSET, data, size);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write waveform container to flash: %s", esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(TAG, "Waveform container with %d tables written to flash", ((const WaveformContainerHeader *)data)->table_count);
+    return true;
 }
 
 __attribute__((optimize("O3")))
 void IRAM_ATTR custom_lut_func(
     const uint32_t *ld,
     uint8_t *epd_input,
-    uint8_t* lut,
-    uint8_t frame
+    const uint8_t* lut,
+    uint32_t frame
 ) {
     uint16_t *ptr = (uint16_t *)ld;
     //uint8_t *ops = (uint8_t *)frame_ops;
@@ -95,7 +696,6 @@ void IRAM_ATTR custom_lut_func(
     uint8_t wave0, wave1, wave2, wave3;
 
     for (uint32_t j = 0; j < 400; j += 1) {
-       // epd_input[j] = lut[*(ptr++)];
         temp = *(ptr++);
 
         wave0 = custom_wave[temp & 0x000F][frame];
@@ -109,34 +709,213 @@ void IRAM_ATTR custom_lut_func(
 }
 
 __attribute__((optimize("O3")))
-void IRAM_ATTR calculate_lut(RenderContext_t *ctx) {
-    uint8_t frame = ctx->current_frame;
-    uint16_t index = 0;
-    uint8_t first_op, second_op, third_op, fourth_op;
-    uint8_t comb_op;
+void IRAM_ATTR difference_lut_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+) {
+    // 4 pixels per input word, the table of each pixel shifts its op into place
+    for (uint32_t j = 0; j < 400; j++) {
+        uint32_t temp = *(ld++);
+        epd_input[j] = lut[temp & 0xFF] | lut[256 + ((temp >> 8) & 0xFF)]
+            | lut[512 + ((temp >> 16) & 0xFF)] | lut[768 + (temp >> 24)];
+    }
+}
 
-    for (uint8_t first = 0; first < 16; first++) {
-        first_op = custom_wave[first][frame] << 6;
+__attribute__((optimize("O3")))
+void IRAM_ATTR lut_64k_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+) {
+    // two lookups per 32 bit input word, 4 pixels each
+    for (uint32_t j = 0; j < 400; j += 2) {
+        uint32_t temp = *(ld++);
+        epd_input[j] = lut[temp & 0xFFFF];
+        epd_input[j + 1] = lut[temp >> 16];
+    }
+}
 
-        for (uint8_t second = 0; second < 16; second++) {
-            second_op = custom_wave[second][frame] << 4;
+__attribute__((optimize("O3")))
+void IRAM_ATTR lut_1k_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+) {
+    // ops of an input byte (2 pixels) in the lower / upper half of an output byte
+    const uint8_t *lut_lo = lut;
+    const uint8_t *lut_hi = lut + 256;
+    uint32_t *out = (uint32_t *)epd_input;
+
+    // 16 pixels per iteration, assembled into one output word
+    for (uint32_t j = 0; j < 100; j++) {
+        uint32_t a = *(ld++);
+        uint32_t b = *(ld++);
+
+        uint32_t ops_a = (lut_lo[a & 0xFF] | lut_hi[(a >> 8) & 0xFF])
+            | ((lut_lo[(a >> 16) & 0xFF] | lut_hi[a >> 24]) << 8);
+        uint32_t ops_b = (lut_lo[b & 0xFF] | lut_hi[(b >> 8) & 0xFF])
+            | ((lut_lo[(b >> 16) & 0xFF] | lut_hi[b >> 24]) << 8);
+
+        *(out++) = ops_a | (ops_b << 16);
+    }
+}
 
-            for (uint8_t third = 0; third < 16; third++) {
-                third_op = custom_wave[third][frame] << 2;
+void IRAM_ATTR calculate_lut_1k(uint8_t *lut, int frame) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t ops = custom_wave[i & 0x0F][frame] | (custom_wave[i >> 4][frame] << 2);
+        lut[i] = ops;
+        lut[i + 256] = ops << 4;
+    }
+}
 
-                for (uint8_t fourth = 0; fourth < 16; fourth++) {
-                    fourth_op = custom_wave[fourth][frame];
+__attribute__((optimize("O3")))
+void IRAM_ATTR planes_lut_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+) {
+    const uint16_t *terms = (const uint16_t *)lut;
+    uint32_t *out = (uint32_t *)epd_input;
+    uint32_t prod[16];
+
+    // 32 pixels per iteration, one word per bit plane
+    for (uint32_t j = 0; j < 50; j++) {
+        uint32_t p0 = *(ld++);
+        uint32_t p1 = *(ld++);
+        uint32_t p2 = *(ld++);
+        uint32_t p3 = *(ld++);
+
+        prod[0x0] = 0xFFFFFFFF;
+        prod[0x1] = p0;
+        prod[0x2] = p1;
+        prod[0x3] = p0 & p1;
+        prod[0x4] = p2;
+        prod[0x5] = p0 & p2;
+        prod[0x6] = p1 & p2;
+        prod[0x7] = prod[0x3] & p2;
+        prod[0x8] = p3;
+        prod[0x9] = p0 & p3;
+        prod[0xA] = p1 & p3;
+        prod[0xB] = prod[0x3] & p3;
+        prod[0xC] = p2 & p3;
+        prod[0xD] = prod[0x5] & p3;
+        prod[0xE] = prod[0x6] & p3;
+        prod[0xF] = prod[0x7] & p3;
+
+        uint32_t dark = 0;
+        for (uint32_t t = terms[0]; t; t &= t - 1) {
+            dark ^= prod[__builtin_ctz(t)];
+        }
+        uint32_t light = 0;
+        for (uint32_t t = terms[1]; t; t &= t - 1) {
+            light ^= prod[__builtin_ctz(t)];
+        }
 
-                    comb_op = first_op | second_op | third_op | fourth_op;
-                    ctx->conversion_lut[index++] = comb_op;
+        // even bits of the planes hold pixels 0-15, odd bits pixels 16-31
+        *(out++) = (dark & 0x55555555) | ((light & 0x55555555) << 1);
+        *(out++) = ((dark >> 1) & 0x55555555) | (light & 0xAAAAAAAA);
+    }
+}
+
+void calculate_plane_terms(uint16_t terms[2], int frame) {
+    for (int b = 0; b < 2; b++) {
+        uint8_t anf[SHADES];
+        for (int s = 0; s < SHADES; s++) {
+            anf[s] = (custom_wave[s][frame] >> b) & 1;
+        }
+        // Moebius transform from the truth table to AND-products
+        for (int i = 1; i < SHADES; i <<= 1) {
+            for (int s = 0; s < SHADES; s++) {
+                if (s & i) {
+                    anf[s] ^= anf[s ^ i];
                 }
             }
         }
+        terms[b] = 0;
+        for (int s = 0; s < SHADES; s++) {
+            terms[b] |= anf[s] << s;
+        }
     }
 }
 
+void IRAM_ATTR uniform_line_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+) {
+    memset(epd_input, frame_info[frame].low_op * 0x55, 400);
+}
 
+/// Output bit mask of the 8 pixels in `word` that are at least the threshold.
+static inline uint32_t threshold_mask(uint32_t word, uint32_t bias) {
+    // both nibbles of each byte are compared in separate byte lanes,
+    // the biased value reaches bit 7 if the shade is >= threshold.
+    uint32_t even = (((word & 0x0F0F0F0F) + bias) >> 7) & 0x01010101;
+    uint32_t odd = ((((word >> 4) & 0x0F0F0F0F) + bias) >> 7) & 0x01010101;
+    // move the bit of pixel p to bit 2p
+    uint32_t m = even | (odd << 2);
+    m = (m | (m >> 4)) & 0x00550055;
+    m = (m | (m >> 8)) & 0x5555;
+    return m * 3;
+}
 
+__attribute__((optimize("O3")))
+void IRAM_ATTR threshold_line_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+) {
+    const FrameInfo *info = &frame_info[frame];
+    uint32_t bias = (0x80 - info->threshold) * 0x01010101;
+    uint32_t low = info->low_op * 0x55555555;
+    uint32_t diff = (info->low_op ^ info->high_op) * 0x55555555;
+    uint32_t *out = (uint32_t *)epd_input;
+
+    for (uint32_t j = 0; j < 100; j++) {
+        uint32_t a = *(ld++);
+        uint32_t b = *(ld++);
+        uint32_t above = threshold_mask(a, bias) | (threshold_mask(b, bias) << 16);
+        *(out++) = low ^ (above & diff);
+    }
+}
 
+__attribute__((optimize("O3")))
+void IRAM_ATTR calculate_lut_part(uint8_t *lut, int frame, int part, int parts) {
+    uint8_t ops[SHADES];
+    for (int s = 0; s < SHADES; s++) {
+        ops[s] = custom_wave[s][frame];
+    }
+
+    // the most significant pixel of the index is split between parts
+    int first_start = part * SHADES / parts;
+    int first_end = (part + 1) * SHADES / parts;
+    uint32_t index = first_start << 12;
+    uint8_t first_op, second_op, third_op;
+
+    for (int first = first_start; first < first_end; first++) {
+        first_op = ops[first] << 6;
+
+        for (uint8_t second = 0; second < 16; second++) {
+            second_op = first_op | (ops[second] << 4);
 
+            for (uint8_t third = 0; third < 16; third++) {
+                third_op = second_op | (ops[third] << 2);
 
+                for (uint8_t fourth = 0; fourth < 16; fourth++) {
+                    lut[index++] = third_op | ops[fourth];
+                }
+            }
+        }
+    }
+}
+
+void IRAM_ATTR calculate_lut(RenderContext_t *ctx) {
+    calculate_lut_part(ctx->conversion_lut, ctx->current_frame, 0, 1);
+}
@@ -17,8 +17,52 @@
 #define SHADES 16
 #define FRAMES 30
 #define WAVEFORM_SIZE (SHADES * FRAMES)  // Assuming SHADES and FRAMES are defined
+#define ALL_SHADES ((1 << SHADES) - 1)
+
+/// Size of a full conversion lookup table, indexed by 4 pixels (16 bits) of input.
+#define LUT_64K_SIZE (1 << 16)
+/// Size of a small conversion lookup table: two tables indexed by 2 pixels (8 bits).
+#define LUT_1K_SIZE 512
 
 extern uint8_t custom_wave[SHADES][FRAMES];
+/// Line time of each frame of `custom_wave` in us, 0 for the shortest line.
+extern int frame_times[FRAMES];
+
+/// Waveform of the rows set by `epd_set_region_mode()`, see `load_region_waveform()`.
+extern uint8_t region_wave[SHADES][FRAMES];
+
+/// Maximum number of frames of the clear sequence.
+#define CLEAR_FRAMES 32
+/// Ends a clear sequence shorter than `CLEAR_FRAMES`.
+#define CLEAR_WAVE_END 3
+/// Ops of the frames clearing the display (e.g. with `MODE_CLEAR_FIRST`),
+/// same for every pixel.
+extern uint8_t clear_wave[CLEAR_FRAMES];
+extern int clear_frame_count;
+
+/// How the ops of a waveform frame depend on the pixel shade.
+enum FrameKind {
+    /// The same op for every shade.
+    FRAME_UNIFORM = 0,
+    /// Shades below `threshold` use `low_op`, all others `high_op`.
+    FRAME_BINARY = 1,
+    /// Anything else, needs a full lookup.
+    FRAME_GENERAL = 2,
+};
+
+typedef struct {
+    enum FrameKind kind;
+    uint8_t threshold;
+    uint8_t low_op;
+    uint8_t high_op;
+} FrameInfo;
+
+/// Classification of the frames in `custom_wave`, see `analyze_waveform()`.
+extern FrameInfo frame_info[FRAMES];
+/// Range of frames in `custom_wave` that drive any pixel, see `analyze_waveform()`.
+/// Leading and trailing no-op frames are outside of it.
+extern int waveform_first_frame;
+extern int waveform_end_frame;
 
 ///////////////////////////// Utils /////////////////////////////////////
 
@@ -60,17 +104,242 @@ typedef struct {
 
 
 
+/**
+ * Reference output calculation: look up every pixel of a 2PPB input line
+ * in `custom_wave` for the given frame.
+ */
 void custom_lut_func(
     const uint32_t *ld,
     uint8_t *epd_input,
-    uint8_t* lut,
-    uint8_t frame
+    const uint8_t* lut,
+    uint32_t frame
+);
+
+/**
+ * Output calculation with a 64K lookup table prepared by `calculate_lut_part()`:
+ * one 16-bit indexed load per 4 pixels.
+ */
+void lut_64k_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
 );
 
 void get_frame_operations(RenderContext_t *ctx);
 
-void save_waveform();
-void load_waveform();
+/// Panel temperature ranges with a waveform of their own.
+#define WAVEFORM_TEMP_RANGES 4
+/// Waveform of the ranges without one of their own.
+#define WAVEFORM_DEFAULT_RANGE -1
+/// No waveform loaded yet.
+#define WAVEFORM_NO_RANGE -2
+/// Lowest temperature of each range in °C.
+extern const int waveform_temp_min[WAVEFORM_TEMP_RANGES];
+
+/// Identifies a waveform container, "EPWF".
+#define WAVEFORM_CONTAINER_MAGIC 0x46575045
+/// Layout of the container, increase when it changes.
+#define WAVEFORM_CONTAINER_VERSION 1
+/// Flash reserved for the container.
+#define WAVEFORM_CONTAINER_MAX_SIZE 0x8000
+/// Table for every temperature range without one of its own.
+#define WAVEFORM_ANY_RANGE 0xFF
+/// The ops of a table are followed by 16 bit frame times in us.
+#define WAVEFORM_TABLE_TIMES 0x01
+/// The table holds ops per transition instead of per shade, see `WaveformTableEntry`.
+#define WAVEFORM_TABLE_TRANSITIONS 0x02
+
+/**
+ * Waveforms for further drawing modes (e.g. `MODE_DU`) as sent by the server,
+ * all fields little endian: this header, `table_count` table entries, then the table data.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t table_count;
+    /// Bytes of the whole container, including this header.
+    uint32_t size;
+    /// CRC32 of all bytes behind this header.
+    uint32_t crc;
+} WaveformContainerHeader;
+
+typedef struct __attribute__((packed)) {
+    /// Waveform mode of `EpdDrawMode`, e.g. `MODE_DU`.
+    uint8_t mode;
+    /// Temperature range, see `waveform_temp_range()`, or `WAVEFORM_ANY_RANGE`.
+    uint8_t range;
+    /// Frames of the table, up to `FRAMES`.
+    uint8_t frames;
+    /// `WAVEFORM_TABLE_TIMES` and `WAVEFORM_TABLE_TRANSITIONS` or 0.
+    uint8_t flags;
+    /// Offset of the table data from the start of the container:
+    /// `frames` ops per shade like `custom_wave`, then the frame times if flagged.
+    /// Transition tables hold `frames` ops per (from, to) pair instead, `from` major.
+    uint32_t offset;
+} WaveformTableEntry;
+
+/**
+ * Temperature range for a panel temperature in °C.
+ */
+int waveform_temp_range(int temperature);
+
+/**
+ * Store the waveform globals in flash as the waveform of `range`,
+ * unless that range already uses them.
+ */
+void save_waveform(int range);
+/**
+ * Remove the stored waveform of the temperature range `range`,
+ * so it uses the default waveform again.
+ */
+void forget_waveform(int range);
+/**
+ * Set the waveform globals to the stored waveform of `range`.
+ * Waveforms are kept in RTC memory across deep sleep and only read from flash
+ * after a cold boot or if the copy is corrupted.
+ */
+void load_waveform(int range);
+/**
+ * Set the waveform globals to the container table of the waveform mode in `mode`
+ * and the temperature `range`. Modes without a table use `load_waveform()`.
+ */
+void load_mode_waveform(enum EpdDrawMode mode, int range);
+/**
+ * Whether the container table that `load_mode_waveform()` would use for `mode`
+ * and `range` has transitions between all shades.
+ */
+bool mode_has_transitions(enum EpdDrawMode mode, int range);
+/**
+ * Frames (bit `f` for frame `f`) in which any pixel changing its shade is driven
+ * by `calculate_difference_lut()`.
+ */
+uint32_t transition_frame_mask();
+
+/**
+ * Calculate the lookup table of `frame` for `MODE_PACKING_1PPB_DIFFERENCE` lines:
+ * `DIFFERENCE_LUT_SIZE` bytes, one table of 256 per pixel of an input word.
+ * Pixels that keep their shade are not driven. The others follow the transition table
+ * of the active mode or, if it has none, the waveform of their new shade.
+ */
+void calculate_difference_lut(uint8_t *lut, int frame);
+
+/**
+ * Output calculation for `MODE_PACKING_1PPB_DIFFERENCE` lines with a table
+ * prepared by `calculate_difference_lut()`: one lookup per pixel.
+ */
+void difference_lut_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+);
+
+/**
+ * Set `region_wave` to the container table of the waveform mode in `mode`
+ * and the temperature `range`. Returns false if the container has none.
+ */
+bool load_region_waveform(enum EpdDrawMode mode, int range);
+
+/**
+ * Frames of `region_wave` in which any of the shades in `shade_mask` is driven.
+ */
+uint32_t region_frame_mask(uint16_t shade_mask);
+
+/**
+ * Calculate the lookup table of `frame` of `region_wave`: a table for `lut_1k_func()`
+ * or, if `difference` is set, for `difference_lut_func()`.
+ */
+void calculate_region_lut(uint8_t *lut, int frame, bool difference);
+
+/**
+ * Check a container received from the server and store it,
+ * unless flash already holds it. Returns false if it is invalid or could not be written.
+ */
+bool store_waveform_container(const uint8_t *data, size_t size);
+
+/**
+ * Take over a clear sequence of `CLEAR_FRAMES` ops, ended early by `CLEAR_WAVE_END`.
+ * Returns false and keeps the current sequence if it contains other values.
+ */
+bool set_clear_wave(const uint8_t *ops);
+
+/**
+ * Classify every frame of `custom_wave` into `frame_info` and find
+ * the range of frames that drive any pixel.
+ * Must be called whenever `custom_wave` changes.
+ */
+void analyze_waveform();
+
+/**
+ * Frames of `custom_wave` (bit `f` for frame `f`) in which any of the shades
+ * in `shade_mask` is driven.
+ */
+uint32_t waveform_frame_mask(uint16_t shade_mask);
+
+/**
+ * Output calculation for `FRAME_UNIFORM` frames: fills the line
+ * without reading the input.
+ */
+void uniform_line_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+);
+
+/**
+ * Output calculation for `FRAME_BINARY` frames of 2PPB lines:
+ * compares 16 pixels at a time to the threshold. `epd_input` must be word aligned.
+ */
+void threshold_line_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+);
 
 void calculate_lut(RenderContext_t *ctx);
 
+/**
+ * Output calculation with a small lookup table prepared by `calculate_lut_1k()`.
+ * Scalar code, one table lookup per input byte. Works on 16 pixels at a time
+ * and writes whole 32 bit output words, so `epd_input` must be word aligned.
+ */
+void lut_1k_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+);
+
+/**
+ * Calculate the small lookup table for `frame`.
+ */
+void calculate_lut_1k(uint8_t *lut, int frame);
+
+/**
+ * Output calculation for `MODE_PACKING_4PLANES` lines, using the boolean
+ * expressions prepared by `calculate_plane_terms()` (passed as `lut`).
+ * `epd_input` must be word aligned.
+ */
+void planes_lut_func(
+    const uint32_t *ld,
+    uint8_t *epd_input,
+    const uint8_t* lut,
+    uint32_t frame
+);
+
+/**
+ * Compile the ops of `frame` into one boolean expression per output bit.
+ * Each expression is the XOR of the AND-products of bit planes
+ * whose bit is set in `terms` (algebraic normal form), product 0 being "true".
+ */
+void calculate_plane_terms(uint16_t terms[2], int frame);
+
+/**
+ * Calculate one of `parts` equally sized slices of the 64K lookup table for `frame`,
+ * so the table can be prepared by multiple threads.
+ */
+void calculate_lut_part(uint8_t *lut, int frame, int part, int parts);
+
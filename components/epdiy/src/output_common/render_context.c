@@ -26,6 +26,10 @@ void get_buffer_params(RenderContext_t *ctx, int *bytes_per_line, const uint8_t*
     } else if (mode & MODE_PACKING_2PPB) {
         *bytes_per_line = area.width / 2 + area.width % 2;
         width_divider = 2;
+    } else if (mode & MODE_PACKING_4PLANES) {
+        // planes are stored in blocks of 32 pixels
+        *bytes_per_line = (area.width + 31) / 32 * 16;
+        width_divider = 2;
     } else if (mode & MODE_PACKING_8PPB) {
         *bytes_per_line = (area.width / 8 + (area.width % 8 > 0));
         width_divider = 8;
@@ -55,7 +59,110 @@ void get_buffer_params(RenderContext_t *ctx, int *bytes_per_line, const uint8_t*
     *pixels_per_byte = width_divider;
 }
 
+lut_func_t get_lut_function(RenderContext_t *ctx) {
+    if (ctx->mode & MODE_PACKING_4PLANES) {
+        return &planes_lut_func;
+    }
+    if (ctx->mode & MODE_PACKING_1PPB_DIFFERENCE) {
+        return &difference_lut_func;
+    }
+    if (!(ctx->mode & MODE_PACKING_2PPB)) {
+        ctx->error |= EPD_DRAW_LOOKUP_NOT_IMPLEMENTED;
+        return NULL;
+    }
+
+    if (ctx->conversion_lut_size == LUT_64K_SIZE) {
+        return &lut_64k_func;
+    } else if (ctx->conversion_lut_size == LUT_1K_SIZE) {
+        return &lut_1k_func;
+    }
+    return &custom_lut_func;
+}
+
+int next_active_frame(const RenderContext_t *ctx, int frame) {
+    while (frame < ctx->cycle_frames && !(ctx->frame_mask & (1 << frame))) {
+        frame++;
+    }
+    return frame;
+}
+
+void select_frame_function(RenderContext_t *ctx) {
+    int frame = ctx->current_frame;
+    const FrameInfo *info = &frame_info[frame];
+    bool planes = ctx->mode & MODE_PACKING_4PLANES;
+
+    ctx->frame_lut = ctx->conversion_lut;
+
+    // the region waveform runs alongside the frames of the draw
+    if (ctx->has_region) {
+        ctx->waveform_active[0] = ctx->main_frame_mask & (1 << frame);
+        ctx->waveform_active[1] = ctx->region_frame_mask & (1 << frame);
+        if (ctx->waveform_active[1]) {
+            bool difference = ctx->mode & MODE_PACKING_1PPB_DIFFERENCE;
+            calculate_region_lut(ctx->region_lut, frame, difference);
+            ctx->region_func = difference ? &difference_lut_func : &lut_1k_func;
+        }
+    }
+
+    // the frame classification is by new shade, but unchanged pixels are not driven
+    if (ctx->mode & MODE_PACKING_1PPB_DIFFERENCE) {
+        calculate_difference_lut(ctx->difference_lut, frame);
+        ctx->frame_func = &difference_lut_func;
+        ctx->frame_lut = ctx->difference_lut;
+        ctx->lut_prepare_frame = -1;
+        return;
+    }
+
+    if (info->kind == FRAME_UNIFORM) {
+        ctx->frame_func = &uniform_line_func;
+    } else if (info->kind == FRAME_BINARY && !planes) {
+        ctx->frame_func = &threshold_line_func;
+    } else {
+        ctx->frame_func = ctx->lut_func;
+
+        // small tables are cheap enough to calculate in between frames
+        if (planes) {
+            calculate_plane_terms(ctx->plane_terms, frame);
+            ctx->frame_lut = (const uint8_t *)ctx->plane_terms;
+        } else if (ctx->lut_func == &lut_1k_func) {
+            calculate_lut_1k(ctx->conversion_lut, frame);
+        } else if (ctx->lut_func == &lut_64k_func && ctx->lut_frame != frame) {
+            if (ctx->lut_back_frame == frame) {
+                uint8_t* next_lut = ctx->conversion_lut_back;
+                ctx->conversion_lut_back = ctx->conversion_lut;
+                ctx->conversion_lut = next_lut;
+                ctx->lut_back_frame = ctx->lut_frame;
+            } else {
+                // no previous frame to prepare it in
+                calculate_lut(ctx);
+            }
+            ctx->lut_frame = frame;
+            ctx->frame_lut = ctx->conversion_lut;
+        }
+    }
+
+    // the next frame that needs a full table is prepared during this one
+    ctx->lut_prepare_frame = -1;
+    if (ctx->lut_func == &lut_64k_func) {
+        int next = next_active_frame(ctx, frame + 1);
+        while (next < ctx->cycle_frames && frame_info[next].kind != FRAME_GENERAL) {
+            next = next_active_frame(ctx, next + 1);
+        }
+        if (next < ctx->cycle_frames && next != ctx->lut_frame && next != ctx->lut_back_frame) {
+            ctx->lut_prepare_frame = next;
+        }
+    }
+}
+
+void finish_frame_function(RenderContext_t *ctx) {
+    if (ctx->lut_prepare_frame >= 0) {
+        ctx->lut_back_frame = ctx->lut_prepare_frame;
+    }
+}
+
 void IRAM_ATTR prepare_context_for_next_frame(RenderContext_t *ctx) {
     ctx->lines_prepared = 0;
-    ctx->lines_consumed = 0;
+    for (int i = 0; i < NUM_RENDER_THREADS; i++) {
+        ctx->chunks_claimed[i] = 0;
+    }
 }
@@ -4,17 +4,39 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
+#include <esp_async_memcpy.h>
 
 #include "../epdiy.h"
-#include "line_queue.h"
 
 #define NUM_RENDER_THREADS 2
+_Static_assert(NUM_RENDER_THREADS <= EPD_STATS_THREADS, "render stats need a counter per thread");
+/// Number of framebuffer rows each render thread fetches ahead of the line it works on.
+#define PREFETCH_ROWS 4
+/// Lines claimed by a render thread at a time. Chunk `c` belongs to thread
+/// `c % NUM_RENDER_THREADS`, so the threads alternate along the frame.
+#define RENDER_CHUNK_LINES 8
+/// A render thread takes over the chunks of another one
+/// that falls behind its own by more than this many chunks.
+#define RENDER_STEAL_LAG 2
+
+/// Size of the lookup table for `MODE_PACKING_1PPB_DIFFERENCE`,
+/// one table indexed by the (to, from) byte for each of 4 pixels.
+#define DIFFERENCE_LUT_SIZE (4 * 256)
+
+typedef void (*lut_func_t)(const uint32_t *, uint8_t *, const uint8_t *, uint32_t);
 
 typedef struct {
     EpdRect area;
     EpdRect crop_to;
     const bool *drawn_lines;
     uint8_t *data_ptr;
+    /// per display row, only the rows set are output while a frame is driven again.
+    /// NULL otherwise.
+    const bool *redrive_rows;
+    /// rows missed by the output, `display_height` entries
+    bool *redrive_buffer;
+    /// see `epd_set_underrun_cb()`
+    void (*underrun_cb)(bool);
 
     /// The display width for quick access.
     int display_width;
@@ -23,19 +45,44 @@ typedef struct {
 
     /// index of the next line of data to process
     atomic_int lines_prepared;
-    volatile int lines_consumed;
+    /// lines `[lines_first, lines_total)` of the display are output
+    int lines_first;
     int lines_total;
+    /// per thread, number of its own chunks claimed in the current frame
+    atomic_int chunks_claimed[NUM_RENDER_THREADS];
 
     /// frame currently in the current update cycle
     int current_frame;
-    /// number of frames in the current update cycle
+    /// frame at which the current update cycle ends (exclusive),
+    /// the cycle may start at a later frame than 0.
     int cycle_frames;
+    /// frames of the cycle that drive any shade of the image, others are skipped
+    uint32_t frame_mask;
+    /// per display row, 1 for the rows drawn with `region_wave` (see `epd_set_region_mode()`),
+    /// 0 for the others. Only used if `has_region` is set.
+    uint8_t *row_waveform;
+    bool has_region;
+    /// mode of the rows marked in `row_waveform`
+    enum EpdDrawMode region_mode;
+    /// frames of the cycle driven by the waveform of the draw and by `region_wave`
+    uint32_t main_frame_mask;
+    uint32_t region_frame_mask;
+    /// per value of `row_waveform`, whether the current frame drives its rows.
+    /// Inactive rows are output as no-ops.
+    bool waveform_active[2];
+    /// shades used by the next image to draw, see `epd_set_shade_mask()`
+    uint16_t shade_mask;
 
     TaskHandle_t feed_tasks[NUM_RENDER_THREADS];
     SemaphoreHandle_t feed_done_smphr[NUM_RENDER_THREADS];
     SemaphoreHandle_t frame_done;
-    /// Line buffers for feed tasks
+    /// Line buffers for feed tasks, `PREFETCH_ROWS` rows of `display_width / 2` bytes each.
     uint8_t* feed_line_buffers[NUM_RENDER_THREADS];
+    /// DMA copy engine fetching framebuffer rows from PSRAM into `feed_line_buffers`.
+    /// NULL if rows are read in place.
+    async_memcpy_handle_t row_dma;
+    /// Set when the row in the corresponding slot of `feed_line_buffers` has arrived.
+    volatile bool row_fetched[NUM_RENDER_THREADS][PREFETCH_ROWS];
 
     /// index of the waveform mode when using vendor waveforms.
     /// This is not necessarily the mode number if the waveform header
@@ -46,6 +93,7 @@ typedef struct {
     /// Draw time for the current frame in 1/10ths of us.
     int frame_time;
 
+    /// Line time of each frame in us (see `epd_lcd_set_line_time()`), NULL for the default.
     const int* phase_times;
 
     const EpdWaveform* waveform;
@@ -53,28 +101,66 @@ typedef struct {
     enum EpdDrawError error;
 
 
+    /// Output calculation function for the current draw.
+    lut_func_t lut_func;
     // Lookup table size.
     size_t conversion_lut_size;
     // Lookup table space.
     uint8_t* conversion_lut;
+    /// Lookup table of the next frame, calculated while the current frame is output.
+    /// NULL if no lookup tables are used.
+    uint8_t* conversion_lut_back;
+    /// Boolean expressions of the current frame for `MODE_PACKING_4PLANES`.
+    uint16_t plane_terms[2];
+    /// Lookup table of the current frame for `MODE_PACKING_1PPB_DIFFERENCE`.
+    uint8_t difference_lut[DIFFERENCE_LUT_SIZE];
+    /// Output calculation and lookup table of the current frame for the rows of the region.
+    lut_func_t region_func;
+    uint8_t region_lut[DIFFERENCE_LUT_SIZE];
+    /// Output calculation function for the current frame,
+    /// specialized if the frame does not need a full lookup.
+    lut_func_t frame_func;
+    /// Lookup data passed to `frame_func` for the current frame.
+    const uint8_t* frame_lut;
+    /// Frames whose tables are in `conversion_lut` / `conversion_lut_back`, -1 if none.
+    int lut_frame;
+    int lut_back_frame;
+    /// Frame whose table the render threads prepare in `conversion_lut_back`
+    /// during the current frame, -1 if none.
+    int lut_prepare_frame;
 
     //uint8_t* frame_operations;
 
-    /// Queue of lines prepared for output to the display,
-    /// one for each thread.
-    LineQueue_t line_queues[NUM_RENDER_THREADS];
-    uint8_t* line_threads;
-
     /// track line skipping when working in old i2s mode
     int skipping;
-} RenderContext_t;
 
-typedef void (*lut_func_t)(const uint32_t *, uint8_t *, const uint8_t *, uint32_t);
+    /// measurements of the current draw
+    EpdRenderStats stats;
+} RenderContext_t;
 
 /**
  * Depending on the render context, decide which LUT function to use.
  * If the lookup fails, an error flag in the context is set.
  */
+lut_func_t get_lut_function(RenderContext_t *ctx);
+
+/**
+ * The first frame of the cycle from `frame` on that is not skipped,
+ * `cycle_frames` if there is none.
+ */
+int next_active_frame(const RenderContext_t *ctx, int frame);
+
+/**
+ * Select the output calculation of the current frame based on its
+ * classification and make sure its lookup data is ready.
+ * Also decides which table the render threads prepare during the frame.
+ */
+void select_frame_function(RenderContext_t *ctx);
+
+/**
+ * Book-keeping for the lookup tables after a frame is output.
+ */
+void finish_frame_function(RenderContext_t *ctx);
 
 /**
  * Based on the render context, assign the bytes per line,
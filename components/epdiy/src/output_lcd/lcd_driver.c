@@ -47,6 +47,7 @@
 #include <esp_private/gdma.h>
 #include <hal/gdma_ll.h>
 #include <rom/cache.h>
+#include <esp_cpu.h>
 
 #include "../output_common/lut.h"
 
@@ -59,9 +60,23 @@ static inline int max(int x, int y) { return x > y ? x : y; }
 //#define S3_LCD_PIN_NUM_MODE           4
 
 #define LINE_BATCH                     600
-#define BOUNCE_BUF_LINES               10
+// lines per DMA EOF interrupt
+#define RING_GROUP_LINES               8
+
+// states of a line slot
+#define SLOT_FREE                      0
+#define SLOT_READY                     1
+// the line is output as a no-op without reading the slot
+#define SLOT_SKIP                      2
 
 #define RMT_CKV_CHAN                   RMT_CHANNEL_1
+// limit of the RMT loop counter
+#define RMT_MAX_LOOPS                  1023
+// limit of the LCD horizontal total width
+#define LCD_MAX_LINE_CYCLES            4096
+// CKV timing in 1/10us for clocking through rows that are not drawn
+#define SKIP_CKV_HIGH_TIME             5
+#define SKIP_CKV_LOW_TIME              5
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
 // The extern line is declared in esp-idf/components/driver/deprecated/rmt_legacy.c. It has access to RMTMEM through the rmt_private.h header
@@ -86,14 +101,46 @@ typedef struct {
 
     int line_length_us;
     int line_cycles;
+    // shortest line the pixel clock allows
+    int min_line_length_us;
     int lcd_res_h;
 
     LcdEpdConfig_t config;
 
-    uint8_t *bounce_buffer[2];
-    // size of a single bounce buffer
-    size_t bb_size;
+    // ring of DMA-capable line slots, written directly by the line producers
+    uint8_t *line_ring;
+    // distance between two line slots
+    size_t slot_size;
+    // output for lines that are not ready in time
+    uint8_t *zero_line;
+    // dummy bytes in front of every line
+    uint8_t *dummy;
+    int dummy_bytes;
+    // line repeated for the whole frame by `solid_nodes`, see `epd_lcd_start_solid_frame()`
+    uint8_t *solid_line;
+    int solid_pattern;
+    // dummy bytes and `solid_line`, linked to each other in a loop
+    dma_descriptor_t *solid_nodes;
+    // set by producers when a slot holds its line or is skipped, cleared when it is released
+    volatile uint8_t slot_ready[LCD_RING_LINES];
+    // lines of the current frame whose slots have been released after output
+    volatile int lines_done;
+    // set when the frame output ended, all of its lines count as released
+    // until the ring is opened for the next frame
+    volatile bool frame_ended;
+    // lines of the current frame that were not ready when queued for output
+    volatile int missed_lines;
+    // per display row, set if the row was missed in the current frame
+    bool *missed_rows;
+    // since `epd_lcd_reset_stats()`
+    LcdEpdStats_t stats;
+    volatile bool frame_active;
     size_t batches;
+    // rows of the display covered by the next frames, see `epd_lcd_set_row_range()`
+    int first_row;
+    int frame_lines;
+    // the gate driver was already clocked to `first_row` for the next frame
+    bool rows_skipped;
 
     // Number of DMA descriptors that used to carry the frame buffer
     size_t num_dma_nodes;
@@ -109,6 +156,9 @@ static s3_lcd_t lcd;
 static int line_bytes = 0;
 static int vertical_lines = 0;
 
+static void ckv_rmt_build_signal();
+static void ckv_rmt_set_signal(int high_time, int low_time);
+
 void IRAM_ATTR epd_lcd_line_source_cb(line_cb_func_t line_source, void* payload) {
     lcd.line_source_cb = line_source;
     lcd.line_cb_payload = payload;
@@ -119,25 +169,117 @@ void IRAM_ATTR epd_lcd_frame_done_cb(frame_done_func_t cb, void* payload) {
     lcd.frame_cb_payload = payload;
 }
 
-static IRAM_ATTR bool fill_bounce_buffer(uint8_t* buffer) {
-    bool task_awoken = false;
+static inline uint8_t* slot_data(int slot) {
+    return &lcd.line_ring[slot * lcd.slot_size];
+}
+
+// producers count display rows, the ring counts output lines of the frame
+bool IRAM_ATTR epd_lcd_line_released(int line) {
+    return lcd.frame_ended || line - lcd.first_row < lcd.lines_done;
+}
+
+uint8_t* IRAM_ATTR epd_lcd_line_slot(int line) {
+    if (lcd.frame_ended) {
+        return NULL;
+    }
+    line -= lcd.first_row;
+    int done = lcd.lines_done;
+    // already output, the slot now belongs to a later line
+    if (line < done || line >= done + LCD_RING_LINES) {
+        return NULL;
+    }
+    return slot_data(line % LCD_RING_LINES);
+}
+
+void IRAM_ATTR epd_lcd_line_ready(int line) {
+    if (epd_lcd_line_released(line)) {
+        return;
+    }
+    lcd.slot_ready[(line - lcd.first_row) % LCD_RING_LINES] = SLOT_READY;
+}
+
+void IRAM_ATTR epd_lcd_line_skip(int line) {
+    if (epd_lcd_line_released(line)) {
+        return;
+    }
+    lcd.slot_ready[(line - lcd.first_row) % LCD_RING_LINES] = SLOT_SKIP;
+}
+
+void epd_lcd_set_row_range(int first_row, int end_row) {
+    assert(0 <= first_row && first_row < end_row && end_row <= vertical_lines);
+    lcd.first_row = first_row;
+    lcd.frame_lines = end_row - first_row;
+    lcd.rows_skipped = false;
+}
+
+int epd_lcd_missed_lines() {
+    return lcd.missed_lines;
+}
+
+const bool* epd_lcd_missed_rows() {
+    return lcd.missed_rows;
+}
+
+void epd_lcd_reset_stats() {
+    memset(&lcd.stats, 0, sizeof(lcd.stats));
+    lcd.stats.min_lines_ahead = -1;
+}
 
-    // a dummy byte is neeed in 8 bit mode to work around LCD peculiarities
-   // int dummy_bytes = lcd.bb_size / BOUNCE_BUF_LINES - line_bytes;
-    int dummy_bytes = 1;
+LcdEpdStats_t epd_lcd_stats() {
+    return lcd.stats;
+}
 
-    for (int i=0; i < BOUNCE_BUF_LINES; i++) {
-        if (lcd.line_source_cb != NULL)  {
-            // this is strange, with 16 bit need a dummy cycle. But still, the first byte in the FIFO is correct.
-            // So we only need a true dummy byte in the FIFO in the 8 bit configuration.
-            task_awoken |= lcd.line_source_cb(lcd.line_cb_payload, &buffer[i * (line_bytes + dummy_bytes) + (dummy_bytes % 2)]);
+/**
+ * Point the descriptors of a group of lines to their data before the DMA reaches them.
+ * Lines come from the line source callback if set, otherwise from the slots
+ * the producers marked as ready.
+ */
+static IRAM_ATTR bool link_line_group(int first_line) {
+    bool task_awoken = false;
+
+    for (int l = first_line; l < first_line + RING_GROUP_LINES; l++) {
+        int slot = l % LCD_RING_LINES;
+        dma_descriptor_t *node = &lcd.dma_nodes[2 * slot + 1];
+
+        if (lcd.line_source_cb != NULL) {
+            task_awoken |= lcd.line_source_cb(lcd.line_cb_payload, slot_data(slot));
+            node->buffer = slot_data(slot);
+        } else if (l < lcd.frame_lines && lcd.slot_ready[slot] == SLOT_READY) {
+            node->buffer = slot_data(slot);
+        } else if (l < lcd.frame_lines && lcd.slot_ready[slot] == SLOT_SKIP) {
+            node->buffer = lcd.zero_line;
         } else {
-            memset(&buffer[i * line_bytes], 0x00, line_bytes);
+            // not ready in time, or past the last line: output a no-op line
+            if (l < lcd.frame_lines) {
+                lcd.missed_lines++;
+                lcd.stats.missed_lines++;
+                lcd.missed_rows[lcd.first_row + l] = true;
+            }
+            node->buffer = lcd.zero_line;
+        }
+    }
+
+    // how far the producers are ahead of the output, unless they are already done
+    if (lcd.line_source_cb == NULL) {
+        int ahead = 0;
+        while (first_line + ahead < lcd.frame_lines && ahead < LCD_RING_LINES - RING_GROUP_LINES
+                && lcd.slot_ready[(first_line + ahead) % LCD_RING_LINES] != SLOT_FREE) {
+            ahead++;
+        }
+        if (first_line + ahead < lcd.frame_lines
+                && (lcd.stats.min_lines_ahead < 0 || ahead < lcd.stats.min_lines_ahead)) {
+            lcd.stats.min_lines_ahead = ahead;
         }
     }
     return task_awoken;
 }
 
+/// Release all lines of the frame, producers that are still busy drop theirs.
+static IRAM_ATTR void end_line_ring() {
+    lcd.frame_active = false;
+    lcd.frame_ended = true;
+}
+
 static void start_ckv_cycles(int cycles) {
 
     rmt_ll_tx_enable_loop_count(&RMT, RMT_CKV_CHAN, true);
@@ -147,12 +289,64 @@ static void start_ckv_cycles(int cycles) {
     rmt_ll_tx_start(&RMT, RMT_CKV_CHAN);
 }
 
-void IRAM_ATTR epd_lcd_start_frame() {
+/**
+ * Select the first row of the frame by clocking the gate driver through
+ * the rows above it with short CKV pulses, while the source driver outputs (XOE) are disabled.
+ * Leaves STV high, so the frame continues from there, and XOE low until the frame starts.
+ */
+static void IRAM_ATTR skip_rows(int rows) {
+    if (lcd.config.bus.oe >= 0) {
+        gpio_set_level(lcd.config.bus.oe, 0);
+    }
+    ckv_rmt_set_signal(SKIP_CKV_HIGH_TIME, SKIP_CKV_LOW_TIME);
+    int period_us = (SKIP_CKV_HIGH_TIME + SKIP_CKV_LOW_TIME + 9) / 10;
+
+    int cycles = min(rows, RMT_MAX_LOOPS);
+    gpio_set_level(lcd.config.bus.stv, 0);
+    esp_rom_delay_us(1);
+    start_ckv_cycles(cycles);
+    // the first pulse latches the start pulse
+    esp_rom_delay_us(period_us);
+    gpio_set_level(lcd.config.bus.stv, 1);
+    esp_rom_delay_us(period_us * (cycles - 1) + 1);
+    rows -= cycles;
+
+    while (rows > 0) {
+        cycles = min(rows, RMT_MAX_LOOPS);
+        start_ckv_cycles(cycles);
+        esp_rom_delay_us(period_us * cycles + 1);
+        rows -= cycles;
+    }
+
+    ckv_rmt_build_signal();
+    lcd.rows_skipped = true;
+}
+
+void epd_lcd_open_line_ring() {
+    for (int i = 0; i < LCD_RING_LINES; i++) {
+        lcd.slot_ready[i] = SLOT_FREE;
+    }
+    lcd.lines_done = 0;
+    lcd.frame_ended = false;
+
+    // the output is idle, so the rows above the frame are skipped here
+    // instead of delaying the frame start on the producer that triggers it
+    if (lcd.first_row > 0 && !lcd.rows_skipped) {
+        skip_rows(lcd.first_row);
+    }
+}
+
+/**
+ * Start the output of a frame with the DMA descriptors starting at `first_node`.
+ * Line slots are only linked while `ring` is set.
+ */
+static void IRAM_ATTR start_frame(dma_descriptor_t *first_node, bool ring) {
     //ESP_LOGI("start frame", "hello");
-    int initial_lines = min(LINE_BATCH, vertical_lines);
+    int initial_lines = min(LINE_BATCH, lcd.frame_lines);
+    // short row ranges fit into the initial batch, which then also gets the padding
+    bool last_batch = lcd.frame_lines < LINE_BATCH;
 
-    //int dummy_bytes = lcd.bb_size / BOUNCE_BUF_LINES - line_bytes;
-    int dummy_bytes = 1;
+    int dummy_bytes = lcd.dummy_bytes;
     // hsync: pulse with, back porch, active width, front porch
     int end_line = lcd.line_cycles - lcd.lcd_res_h - lcd.config.le_high_time - lcd.config.line_front_porch;
     lcd_ll_set_horizontal_timing(lcd.hal.dev,
@@ -162,7 +356,7 @@ void IRAM_ATTR epd_lcd_start_frame() {
             lcd.lcd_res_h + (dummy_bytes > 0),
             end_line
     );
-    lcd_ll_set_vertical_timing(lcd.hal.dev, 1, 1, initial_lines, 1);
+    lcd_ll_set_vertical_timing(lcd.hal.dev, 1, 1, initial_lines, last_batch ? 10 : 1);
 
     // generate the hsync at the very beginning of line
     lcd_ll_set_hsync_position(lcd.hal.dev, 1);
@@ -173,25 +367,46 @@ void IRAM_ATTR epd_lcd_start_frame() {
     gdma_reset(lcd.dma_chan);
     lcd_ll_stop(lcd.hal.dev);
     lcd_ll_fifo_reset(lcd.hal.dev);
-    lcd_ll_enable_auto_next_frame(lcd.hal.dev, true);
+    lcd_ll_enable_auto_next_frame(lcd.hal.dev, !last_batch);
 
     lcd.batches = 0;
-    fill_bounce_buffer(lcd.bounce_buffer[0]);
-    fill_bounce_buffer(lcd.bounce_buffer[1]);
+    if (lcd.missed_lines > 0) {
+        memset(lcd.missed_rows, 0, vertical_lines);
+    }
+    lcd.missed_lines = 0;
+    if (ring) {
+        lcd.frame_active = true;
+        link_line_group(0);
+        link_line_group(RING_GROUP_LINES);
+    }
+
+    // rows above the frame are not drawn, usually they were skipped when the ring was opened
+    if (lcd.first_row > 0) {
+        if (!lcd.rows_skipped) {
+            skip_rows(lcd.first_row);
+        }
+        if (lcd.config.bus.oe >= 0) {
+            gpio_set_level(lcd.config.bus.oe, 1);
+        }
+        lcd.rows_skipped = false;
+    }
 
     // the start of DMA should be prior to the start of LCD engine
-    gdma_start(lcd.dma_chan, (intptr_t)&lcd.dma_nodes[0]);
+    gdma_start(lcd.dma_chan, (intptr_t)first_node);
 
     // enter a critical section to ensure the frame start timing is correct
     taskENTER_CRITICAL(&frame_start_spinlock);
 
     // delay 1us is sufficient for DMA to pass data to LCD FIFO
     // in fact, this is only needed when LCD pixel clock is set too high
-    gpio_set_level(lcd.config.bus.stv, 0);
+    // (the start pulse was already given when rows were skipped)
+    if (lcd.first_row == 0) {
+        gpio_set_level(lcd.config.bus.stv, 0);
+    }
     esp_rom_delay_us(1);
     // for picture clarity, it seems to be important to start CKV at a "good"
     // time, seemingly start or towards end of line.
-    start_ckv_cycles(initial_lines + 5);
+    start_ckv_cycles(initial_lines + 5 + (last_batch ? 10 : 0));
     esp_rom_delay_us(lcd.line_length_us);
     gpio_set_level(lcd.config.bus.stv, 1);
     esp_rom_delay_us(lcd.line_length_us);
@@ -203,14 +418,33 @@ void IRAM_ATTR epd_lcd_start_frame() {
     taskEXIT_CRITICAL(&frame_start_spinlock);
 }
 
+void IRAM_ATTR epd_lcd_start_frame() {
+    start_frame(&lcd.dma_nodes[0], true);
+}
+
+void IRAM_ATTR epd_lcd_start_solid_frame(uint8_t pattern) {
+    if (lcd.solid_pattern != pattern) {
+        memset(lcd.solid_line, pattern, line_bytes);
+        lcd.solid_pattern = pattern;
+    }
+    start_frame(&lcd.solid_nodes[0], false);
+}
+
 /**
  * Build the RMT signal according to the timing set in the lcd object.
  */
 static void ckv_rmt_build_signal() {
   int low_time = (lcd.line_length_us * 10 - lcd.config.ckv_high_time);
+  ckv_rmt_set_signal(lcd.config.ckv_high_time, low_time);
+}
+
+/**
+ * Set one CKV period of the RMT signal, times in 1/10us.
+ */
+static void ckv_rmt_set_signal(int high_time, int low_time) {
   volatile rmt_item32_t *rmt_mem_ptr =
       &(RMTMEM.chan[RMT_CKV_CHAN].data32[0]);
-    rmt_mem_ptr->duration0 = lcd.config.ckv_high_time;
+    rmt_mem_ptr->duration0 = high_time;
     rmt_mem_ptr->level0 = 1;
     rmt_mem_ptr->duration1 = low_time;
     rmt_mem_ptr->level1 = 0;
@@ -255,9 +489,12 @@ IRAM_ATTR static void lcd_isr_vsync(void *args)
     lcd_ll_clear_interrupt_status(lcd.hal.dev, intr_status);
 
     if (intr_status & LCD_LL_EVENT_VSYNC_END) {
-        int batches_needed = vertical_lines / LINE_BATCH ;
-        if (lcd.batches >= batches_needed) {
+        int batches_needed = lcd.frame_lines / LINE_BATCH ;
+        // counted first, the frame done callback may lead to the start of the next frame
+        int batch = lcd.batches++;
+        if (batch >= batches_needed) {
             lcd_ll_stop(lcd.hal.dev);
+            end_line_ring();
             //rmt_ll_tx_stop(&RMT, RMT_CKV_CHAN);
             if (lcd.frame_done_cb != NULL) {
                 (*lcd.frame_done_cb)(lcd.frame_cb_payload);
@@ -267,10 +504,10 @@ IRAM_ATTR static void lcd_isr_vsync(void *args)
         } else {
             int ckv_cycles = 0;
             // last batch
-            if (lcd.batches == batches_needed - 1) {
+            if (batch == batches_needed - 1) {
                 lcd_ll_enable_auto_next_frame(lcd.hal.dev, false);
-                lcd_ll_set_vertical_timing(lcd.hal.dev, 1, 0, vertical_lines % LINE_BATCH, 10);
-                ckv_cycles = vertical_lines % LINE_BATCH + 10;
+                lcd_ll_set_vertical_timing(lcd.hal.dev, 1, 0, lcd.frame_lines % LINE_BATCH, 10);
+                ckv_cycles = lcd.frame_lines % LINE_BATCH + 10;
             } else {
                 lcd_ll_set_vertical_timing(lcd.hal.dev, 1, 0, LINE_BATCH, 1);
                 ckv_cycles = LINE_BATCH + 1;
@@ -283,8 +520,6 @@ IRAM_ATTR static void lcd_isr_vsync(void *args)
 
             start_ckv_cycles(ckv_cycles);
         }
-
-        lcd.batches += 1;
     }
 
     if (need_yield) {
@@ -292,38 +527,74 @@ IRAM_ATTR static void lcd_isr_vsync(void *args)
     }
 };
 
-// ISR handling bounce buffer refill
+// ISR handing line slots back to the producers
 static IRAM_ATTR bool lcd_rgb_panel_eof_handler(gdma_channel_handle_t dma_chan, gdma_event_data_t *event_data, void *user_data)
 {
-    dma_descriptor_t *desc = (dma_descriptor_t *)event_data->tx_eof_desc_addr;
-    // Figure out which bounce buffer to write to.
-    // Note: what we receive is the *last* descriptor of this bounce buffer.
-    int bb = (desc == &lcd.dma_nodes[0]) ? 0 : 1;
+    // the DMA may still run into the padding lines after the frame
+    if (!lcd.frame_active) {
+        return false;
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
 
-    bool need_yield = fill_bounce_buffer(lcd.bounce_buffer[bb]);
+    // the oldest group of lines is transferred, release its slots
+    int done = lcd.lines_done;
+    for (int l = done; l < done + RING_GROUP_LINES; l++) {
+        lcd.slot_ready[l % LCD_RING_LINES] = SLOT_FREE;
+    }
+    lcd.lines_done = done + RING_GROUP_LINES;
 
-    return need_yield;
+    // the following group is being transferred, queue the one after it
+    bool task_awoken = link_line_group(done + 2 * RING_GROUP_LINES);
+
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    lcd.stats.eof_interrupts++;
+    if (cycles > lcd.stats.eof_max_cycles) {
+        lcd.stats.eof_max_cycles = cycles;
+    }
+    return task_awoken;
 }
 
 static esp_err_t init_dma_trans_link() {
 
-    //ESP_LOGI(TAG, "size: %d max: %d", lcd.bb_size, DMA_DESCRIPTOR_BUFFER_MAX_SIZE);
-
-    lcd.dma_nodes[0].dw0.suc_eof = 1;
-    lcd.dma_nodes[0].dw0.size = lcd.bb_size;
-    lcd.dma_nodes[0].dw0.length = lcd.bb_size;
-    lcd.dma_nodes[0].dw0.owner = DMA_DESCRIPTOR_BUFFER_OWNER_CPU;
-    lcd.dma_nodes[0].buffer = lcd.bounce_buffer[0];
-
-    lcd.dma_nodes[1].dw0.suc_eof = 1;
-    lcd.dma_nodes[1].dw0.size = lcd.bb_size;
-    lcd.dma_nodes[1].dw0.length = lcd.bb_size;
-    lcd.dma_nodes[1].dw0.owner = DMA_DESCRIPTOR_BUFFER_OWNER_CPU;
-    lcd.dma_nodes[1].buffer = lcd.bounce_buffer[1];
+    // Two descriptors per line: the dummy bytes, then the line slot.
+    // The slots stay word aligned for the producers this way.
+    for (int slot = 0; slot < LCD_RING_LINES; slot++) {
+        dma_descriptor_t *dummy = &lcd.dma_nodes[2 * slot];
+        dma_descriptor_t *data = &lcd.dma_nodes[2 * slot + 1];
+
+        dummy->dw0.suc_eof = 0;
+        dummy->dw0.size = lcd.dummy_bytes;
+        dummy->dw0.length = lcd.dummy_bytes;
+        dummy->dw0.owner = DMA_DESCRIPTOR_BUFFER_OWNER_CPU;
+        dummy->buffer = lcd.dummy;
+        dummy->next = data;
+
+        // interrupt after every group of lines
+        data->dw0.suc_eof = (slot % RING_GROUP_LINES == RING_GROUP_LINES - 1);
+        data->dw0.size = line_bytes;
+        data->dw0.length = line_bytes;
+        data->dw0.owner = DMA_DESCRIPTOR_BUFFER_OWNER_CPU;
+        data->buffer = slot_data(slot);
+        // loop end back to start
+        data->next = &lcd.dma_nodes[(2 * slot + 2) % (2 * LCD_RING_LINES)];
+    }
 
-    // loop end back to start
-    lcd.dma_nodes[0].next = &lcd.dma_nodes[1];
-    lcd.dma_nodes[1].next = &lcd.dma_nodes[0];
+    // A single line looping onto itself, without interrupts.
+    // The LCD peripheral ends the frame on its own.
+    dma_descriptor_t *solid_dummy = &lcd.solid_nodes[0];
+    dma_descriptor_t *solid_data = &lcd.solid_nodes[1];
+    solid_dummy->dw0.suc_eof = 0;
+    solid_dummy->dw0.size = lcd.dummy_bytes;
+    solid_dummy->dw0.length = lcd.dummy_bytes;
+    solid_dummy->dw0.owner = DMA_DESCRIPTOR_BUFFER_OWNER_CPU;
+    solid_dummy->buffer = lcd.dummy;
+    solid_dummy->next = solid_data;
+    solid_data->dw0.suc_eof = 0;
+    solid_data->dw0.size = line_bytes;
+    solid_data->dw0.length = line_bytes;
+    solid_data->dw0.owner = DMA_DESCRIPTOR_BUFFER_OWNER_CPU;
+    solid_data->buffer = lcd.solid_line;
+    solid_data->next = solid_dummy;
 
     // alloc DMA channel and connect to LCD peripheral
     gdma_channel_alloc_config_t dma_chan_config = {
@@ -417,8 +688,12 @@ void IRAM_ATTR epd_lcd_init(const LcdEpdConfig_t* config, int display_width, int
 
     // assign globals
     line_bytes = 400;
-    // Make sure the bounce buffers divide the display height evenly.
+    // Make sure the line groups divide the display height evenly.
     vertical_lines = 1200;
+    lcd.first_row = 0;
+    lcd.frame_lines = vertical_lines;
+    epd_lcd_set_ring_prefill(config->ring_prefill);
+    epd_lcd_reset_stats();
     esp_err_t ret = ESP_OK;
 
     lcd.lcd_res_h = line_bytes / (lcd.config.bus_width / 8);
@@ -452,27 +727,32 @@ void IRAM_ATTR epd_lcd_init(const LcdEpdConfig_t* config, int display_width, int
     periph_module_enable(lcd_periph_signals.panels[0].module);
     periph_module_reset(lcd_periph_signals.panels[0].module);
 
-    // each bounce buffer holds two lines of display data
-
     // With 8 bit bus width, we need a dummy cycle before the actual data,
     // because the LCD peripheral behaves weirdly.
     // Also see:
     // https://blog.adafruit.com/2022/06/14/esp32uesday-hacking-the-esp32-s3-lcd-peripheral/
     int dummy_bytes = lcd.config.bus_width / 8;
-    //int dummy_bytes = 0;
-    lcd.bb_size = BOUNCE_BUF_LINES * (line_bytes + dummy_bytes);
-    //assert(lcd.bb_size % (line_bytes) == 1);
-    size_t num_dma_nodes = (lcd.bb_size + DMA_DESCRIPTOR_BUFFER_MAX_SIZE - 1) / DMA_DESCRIPTOR_BUFFER_MAX_SIZE;
-   // ESP_LOGI(TAG, "num dma nodes: %u", num_dma_nodes);
-    lcd.dma_nodes = heap_caps_calloc(1, num_dma_nodes * sizeof(dma_descriptor_t) * 2, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    lcd.dummy_bytes = dummy_bytes;
+
+    lcd.num_dma_nodes = 2 * LCD_RING_LINES;
+    lcd.dma_nodes = heap_caps_calloc(1, lcd.num_dma_nodes * sizeof(dma_descriptor_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
     ESP_GOTO_ON_FALSE(lcd.dma_nodes, ESP_ERR_NO_MEM, err, TAG, "no mem for rgb panel");
 
-    // alloc bounce buffer
-    for (int i = 0; i < 2; i++) {
-        // bounce buffer must come from SRAM
-        lcd.bounce_buffer[i] = heap_caps_aligned_calloc(4, 1, lcd.bb_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
-        ESP_GOTO_ON_ERROR(ret, err, TAG, "install interrupt failed");
-    }
+    // line slots must come from SRAM
+    lcd.slot_size = (line_bytes + 15) / 16 * 16;
+    lcd.line_ring = heap_caps_aligned_calloc(16, LCD_RING_LINES, lcd.slot_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    ESP_GOTO_ON_FALSE(lcd.line_ring, ESP_ERR_NO_MEM, err, TAG, "no mem for line ring");
+    lcd.zero_line = heap_caps_aligned_calloc(4, 1, line_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    ESP_GOTO_ON_FALSE(lcd.zero_line, ESP_ERR_NO_MEM, err, TAG, "no mem for line ring");
+    lcd.dummy = heap_caps_aligned_calloc(4, 1, 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    ESP_GOTO_ON_FALSE(lcd.dummy, ESP_ERR_NO_MEM, err, TAG, "no mem for line ring");
+    lcd.solid_line = heap_caps_aligned_calloc(4, 1, line_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    ESP_GOTO_ON_FALSE(lcd.solid_line, ESP_ERR_NO_MEM, err, TAG, "no mem for solid line");
+    lcd.solid_pattern = 0x00;
+    lcd.missed_rows = heap_caps_calloc(1, vertical_lines, MALLOC_CAP_INTERNAL);
+    ESP_GOTO_ON_FALSE(lcd.missed_rows, ESP_ERR_NO_MEM, err, TAG, "no mem for missed rows");
+    lcd.solid_nodes = heap_caps_calloc(2, sizeof(dma_descriptor_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    ESP_GOTO_ON_FALSE(lcd.solid_nodes, ESP_ERR_NO_MEM, err, TAG, "no mem for solid line");
 
     lcd_hal_init(&lcd.hal, 0);
     lcd_ll_enable_clock(lcd.hal.dev, true);
@@ -547,6 +827,10 @@ err:
 }
 
 
+int epd_lcd_pixel_clock_MHz() {
+    return lcd.config.pixel_clock / 1000 / 1000;
+}
+
 void epd_lcd_set_pixel_clock_MHz(int frequency) {
     lcd.config.pixel_clock = frequency * 1000 * 1000;
 
@@ -556,9 +840,32 @@ void epd_lcd_set_pixel_clock_MHz(int frequency) {
     ESP_LOGI(TAG, "pclk freq: %d Hz", freq);
     lcd.line_length_us = (lcd.lcd_res_h + lcd.config.le_high_time + lcd.config.line_front_porch - 1) * 1000000 / lcd.config.pixel_clock + 1;
     lcd.line_cycles = lcd.line_length_us * lcd.config.pixel_clock / 1000000;
+    lcd.min_line_length_us = lcd.line_length_us;
     ESP_LOGI(TAG, "line width: %dus, %d cylces", lcd.line_length_us, lcd.line_cycles);
 
     ckv_rmt_build_signal();
 }
 
+int epd_lcd_ring_prefill() {
+    return lcd.config.ring_prefill;
+}
+
+void epd_lcd_set_ring_prefill(int lines) {
+    if (lines <= 0 || lines > LCD_RING_LINES) {
+        lines = LCD_RING_LINES;
+    }
+    // The first two line groups are linked when the frame starts, so the
+    // trigger line has to lie beyond them: with only those groups prefilled,
+    // lines of the other producer could still be unrendered when linked.
+    lcd.config.ring_prefill = max(lines, 3 * RING_GROUP_LINES);
+}
+
+void epd_lcd_set_line_time(int line_time_us) {
+    int max_line_length_us = LCD_MAX_LINE_CYCLES * (uint64_t)1000000 / lcd.config.pixel_clock;
+    lcd.line_length_us = min(max(line_time_us, lcd.min_line_length_us), max_line_length_us);
+    lcd.line_cycles = lcd.line_length_us * lcd.config.pixel_clock / 1000000;
+
+    ckv_rmt_build_signal();
+}
+
 
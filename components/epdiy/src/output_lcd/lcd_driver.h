@@ -41,6 +41,9 @@ typedef struct {
   gpio_num_t leh;
   // vertical start pulse, resetting the vertical line shift register.
   gpio_num_t stv;
+  // output enable of the source drivers (XOE), also set with the mode.
+  // Disabled while rows are skipped. -1 if not connected.
+  gpio_num_t oe;
 } lcd_bus_config_t;
 
 /// Configuration structure for the LCD-based Epd driver.
@@ -52,8 +55,25 @@ typedef struct {
     int le_high_time; // = 4
     int bus_width; // = 16
     lcd_bus_config_t bus;
+    // lines rendered into the output ring before a frame starts, 0 for the whole ring.
+    int ring_prefill;
 } LcdEpdConfig_t;
 
+/// Output statistics, see `epd_lcd_stats()`.
+typedef struct {
+    /// Line group (EOF) interrupts handled.
+    uint32_t eof_interrupts;
+    /// Longest line group interrupt in CPU cycles.
+    uint32_t eof_max_cycles;
+    /// Fewest lines ready ahead of the output when a line group was queued, -1 if unknown.
+    int min_lines_ahead;
+    /// Lines output as no-ops because they were not ready in time.
+    uint32_t missed_lines;
+} LcdEpdStats_t;
+
+/// Number of line slots in the output ring.
+#define LCD_RING_LINES 128
+
 typedef bool(*line_cb_func_t)(void*, uint8_t*);
 typedef void(*frame_done_func_t)(void*);
 
@@ -61,7 +81,86 @@ void epd_lcd_init(const LcdEpdConfig_t* config, int display_width, int display_h
 void epd_lcd_frame_done_cb(frame_done_func_t, void* payload);
 void epd_lcd_line_source_cb(line_cb_func_t, void* payload);
 void epd_lcd_start_frame();
+/**
+ * Output a frame where every line is `pattern` repeated, e.g. to clear the display.
+ * The DMA loops over one prepared line, so neither the line source nor the producers
+ * are involved and no per-line interrupts occur.
+ */
+void epd_lcd_start_solid_frame(uint8_t pattern);
+/**
+ * Hand all line slots to the producers of the next frame.
+ * After a frame ended, its lines stay released until this is called,
+ * so it must only be called once all producers of that frame are done.
+ * Also clocks the gate driver past the rows above the row range,
+ * so `epd_lcd_start_frame()` does not wait for that.
+ */
+void epd_lcd_open_line_ring();
+/**
+ * Whether `line` of the current frame was already output, or the frame ended.
+ * Its slot may belong to a later line, so producers must drop it.
+ * The output counts such lines as missed.
+ */
+bool epd_lcd_line_released(int line);
+/**
+ * Output slot for `line` of the current frame, or NULL if the slot is still
+ * in use by the output of an earlier line or `line` was already released.
+ * The line data is written to the slot directly, then marked with `epd_lcd_line_ready()`.
+ * Slots are word aligned.
+ */
+uint8_t* epd_lcd_line_slot(int line);
+/**
+ * Mark the slot of `line` as ready for output.
+ * Lines that are not ready when the DMA needs them are output as no-ops.
+ * Does nothing if `line` was already released.
+ */
+void epd_lcd_line_ready(int line);
+/**
+ * Output `line` as a no-op without writing its slot,
+ * once `epd_lcd_line_slot()` returned the slot.
+ */
+void epd_lcd_line_skip(int line);
+/**
+ * Only output display rows `[first_row, end_row)` in the following frames.
+ * Rows above are skipped with short CKV pulses before the frame starts, rows below are not clocked at all.
+ * Line numbers passed to the producer functions stay display rows.
+ * Must not be called while a frame is output.
+ */
+void epd_lcd_set_row_range(int first_row, int end_row);
+/**
+ * Number of lines of the last frame that were output as no-ops,
+ * because they were not ready in time.
+ */
+int epd_lcd_missed_lines();
+/**
+ * Display rows of the last frame that were output as no-ops, because they were not ready in time.
+ * Valid until the next frame starts.
+ */
+const bool* epd_lcd_missed_rows();
+/**
+ * Statistics of the frames output since the last `epd_lcd_reset_stats()`.
+ */
+LcdEpdStats_t epd_lcd_stats();
+void epd_lcd_reset_stats();
+int epd_lcd_pixel_clock_MHz();
 /**
  * Set the LCD pixel clock frequency in MHz.
  */
 void epd_lcd_set_pixel_clock_MHz(int frequency);
+/**
+ * Number of lines the producers render before a frame is started.
+ * Fewer lines start the output earlier, but leave less slack before lines are missed.
+ */
+int epd_lcd_ring_prefill();
+/**
+ * Set the lines rendered before a frame is started,
+ * limited to the ring size. 0 selects the whole ring.
+ * At least three line groups (24 lines) are prefilled, the first two are linked at the start.
+ */
+void epd_lcd_set_ring_prefill(int lines);
+/**
+ * Set the time each row is driven in the following frames, in us.
+ * It is extended by horizontal blanking and limited to the shortest line
+ * the pixel clock allows, 0 selects that shortest line.
+ * Must not be called while a frame is output.
+ */
+void epd_lcd_set_line_time(int line_time_us);
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -7,13 +8,15 @@
 
 #include <rom/cache.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_memory_utils.h>
+#include <esp_async_memcpy.h>
 
 #include "render_lcd.h"
 #include "epd_board.h"
 #include "epdiy.h"
 #include "../epd_internals.h"
 #include "lcd_driver.h"
-#include "../output_common/line_queue.h"
 #include "../output_common/lut.h"
 #include "../output_common/render_context.h"
 #include "../../../main/config.h"
@@ -24,76 +27,180 @@ static bool IRAM_ATTR fill_line_noop(RenderContext_t* ctx, uint8_t *line) {
     return false;
 }
 
-static bool IRAM_ATTR fill_line_white(RenderContext_t* ctx, uint8_t *line) {
-    memset(line, CLEAR_BYTE, ctx->display_width / 4);
-    return false;
-}
 
-static bool IRAM_ATTR fill_line_black(RenderContext_t* ctx, uint8_t *line) {
-    memset(line, DARK_BYTE, ctx->display_width / 4);
-    return false;
-}
+// longest wait of a render thread for a line slot before it drops the line,
+// far beyond the output time of a frame
+#define SLOT_WAIT_TIMEOUT_US 1000000
 
-static bool IRAM_ATTR fill_line_stripe(RenderContext_t* ctx, uint8_t *line) {
-    memset(line, 0B01011010, ctx->display_width / 4);
-    return false;
+#define int_min(a, b) (((a) < (b)) ? (a) : (b))
+#define int_max(a, b) (((a) > (b)) ? (a) : (b))
+
+/// start the next frame in the current update cycle
+static void IRAM_ATTR handle_lcd_frame_done(RenderContext_t *ctx) {
+    epd_lcd_frame_done_cb(NULL, NULL);
+    epd_lcd_line_source_cb(NULL, NULL);
+
+    BaseType_t task_awoken = pdFALSE;
+    xSemaphoreGiveFromISR(ctx->frame_done, &task_awoken);
+
+    portYIELD_FROM_ISR();
 }
 
-__attribute__((optimize("O3")))
-static bool IRAM_ATTR retrieve_line_isr(RenderContext_t* ctx, uint8_t *buf) {
-    if (ctx->lines_consumed >= ctx->lines_total) {
+/**
+ * Narrow the output to the rows from the first to the last drawn line,
+ * the display driver skips the others quickly.
+ * Returns false if no line is drawn at all.
+ */
+static bool limit_output_rows(RenderContext_t *ctx) {
+    int min_y, max_y, bytes_per_line, _ppB;
+    const uint8_t *ptr_start;
+    get_buffer_params(ctx, &bytes_per_line, &ptr_start, &min_y, &max_y, &_ppB);
+
+    int first = int_max(min_y, 0);
+    int end = int_min(max_y, ctx->display_height);
+    if (ctx->drawn_lines != NULL) {
+        while (first < end && !ctx->drawn_lines[first - ctx->area.y]) {
+            first++;
+        }
+        while (end > first && !ctx->drawn_lines[end - 1 - ctx->area.y]) {
+            end--;
+        }
+    }
+    if (first >= end) {
         return false;
     }
-    int thread = ctx->line_threads[ctx->lines_consumed];
-    assert(thread < NUM_RENDER_THREADS);
 
-    LineQueue_t *lq = &ctx->line_queues[thread];
+    ctx->lines_first = first;
+    ctx->lines_total = end;
+    epd_lcd_set_row_range(first, end);
+    return true;
+}
 
-    BaseType_t awoken = pdFALSE;
+/**
+ * Drive the current frame with the rendered lines: start the render threads,
+ * which start the output, and wait until both are done.
+ */
+static void drive_frame(RenderContext_t *ctx) {
+    // light frames can be driven shorter than heavy ones
+    epd_lcd_set_line_time(ctx->phase_times != NULL ? ctx->phase_times[ctx->current_frame] : 0);
 
-    if (lq_read(lq, buf) != 0) {
-        ctx->error |= EPD_DRAW_EMPTY_LINE_QUEUE;
-        memset(buf, 0x00, ctx->display_width / 4);
-    }
+    epd_lcd_frame_done_cb((frame_done_func_t)handle_lcd_frame_done, ctx);
+    prepare_context_for_next_frame(ctx);
 
-    if (ctx->lines_consumed >= ctx->display_height) {
-        memset(buf, 0x00, ctx->display_width / 4);
-    }
-    ctx->lines_consumed += 1;
-    return awoken;
-}
+    // the producers of the last frame are done, their lines were released
+    epd_lcd_open_line_ring();
 
-/// start the next frame in the current update cycle
-static void IRAM_ATTR handle_lcd_frame_done(RenderContext_t *ctx) {
-    epd_lcd_frame_done_cb(NULL, NULL);
-    epd_lcd_line_source_cb(NULL, NULL);
+    // start both feeder tasks
+    xTaskNotifyGive(ctx->feed_tasks[!xPortGetCoreID()]);
+    xTaskNotifyGive(ctx->feed_tasks[xPortGetCoreID()]);
 
-    BaseType_t task_awoken = pdFALSE;
-    xSemaphoreGiveFromISR(ctx->frame_done, &task_awoken);
+    // transmission is started in renderer threads, now wait util it's done
+    xSemaphoreTake(ctx->frame_done, portMAX_DELAY);
 
-    portYIELD_FROM_ISR();
+    for (int i = 0; i < NUM_RENDER_THREADS; i++) {
+        xSemaphoreTake(ctx->feed_done_smphr[i], portMAX_DELAY);
+    }
+}
+
+/**
+ * Drive the rows the output missed in the last frame once more.
+ * They were output as no-ops, so the other rows must not be driven twice.
+ * Returns false if rows were missed again.
+ */
+static bool redrive_missed_rows(RenderContext_t *ctx) {
+    const bool *missed = epd_lcd_missed_rows();
+    int first = ctx->lines_total;
+    int end = ctx->lines_first;
+    for (int l = ctx->lines_first; l < ctx->lines_total; l++) {
+        ctx->redrive_buffer[l] = missed[l];
+        if (missed[l]) {
+            first = int_min(first, l);
+            end = l + 1;
+        }
+    }
+    ESP_LOGW("epd_lcd", "%d lines of frame %d missed, driving them again", epd_lcd_missed_lines(), ctx->current_frame);
+
+    int lines_first = ctx->lines_first;
+    int lines_total = ctx->lines_total;
+    ctx->lines_first = first;
+    ctx->lines_total = end;
+    ctx->redrive_rows = ctx->redrive_buffer;
+    epd_lcd_set_row_range(first, end);
+
+    // the table of the frame is still in front, nothing is prepared meanwhile
+    select_frame_function(ctx);
+    drive_frame(ctx);
+    ctx->stats.redrives++;
+
+    ctx->lines_first = lines_first;
+    ctx->lines_total = lines_total;
+    ctx->redrive_rows = NULL;
+    epd_lcd_set_row_range(lines_first, lines_total);
+    return epd_lcd_missed_lines() == 0;
 }
 
 void lcd_do_update(RenderContext_t *ctx) {
 
+    // nothing to draw
+    if (!ctx->error && !limit_output_rows(ctx)) {
+        return;
+    }
+
     set_mode(1);
+    epd_lcd_reset_stats();
+
+    // the clear sequence leads the waveform, its frames need no rendering
+    if ((ctx->mode & MODE_CLEAR_FIRST) && !ctx->error) {
+        int64_t clear_start = esp_timer_get_time();
+        const uint8_t op_bytes[3] = {0x00, DARK_BYTE, CLEAR_BYTE};
+        for (int f = 0; f < clear_frame_count; f++) {
+            epd_lcd_frame_done_cb((frame_done_func_t)handle_lcd_frame_done, ctx);
+            epd_lcd_start_solid_frame(op_bytes[clear_wave[f]]);
+            xSemaphoreTake(ctx->frame_done, portMAX_DELAY);
+        }
+        ctx->stats.clear_time_us = esp_timer_get_time() - clear_start;
+    }
+
+    ctx->lut_frame = -1;
+    ctx->lut_back_frame = -1;
 
-    for (uint8_t k = 0; k < ctx->cycle_frames; k++) {
-        epd_lcd_frame_done_cb((frame_done_func_t)handle_lcd_frame_done, ctx);
-        prepare_context_for_next_frame(ctx);
+    // the output fell behind during this update
+    bool relieved = false;
+    int pixel_clock_MHz = epd_lcd_pixel_clock_MHz();
+    bool lines_lost = false;
 
-        // start both feeder tasks
-        xTaskNotifyGive(ctx->feed_tasks[!xPortGetCoreID()]);
-        xTaskNotifyGive(ctx->feed_tasks[xPortGetCoreID()]);
+    ctx->current_frame = next_active_frame(ctx, ctx->current_frame);
+    while (ctx->current_frame < ctx->cycle_frames) {
+        select_frame_function(ctx);
 
-        // transmission is started in renderer threads, now wait util it's done
-        xSemaphoreTake(ctx->frame_done, portMAX_DELAY);
+        int64_t frame_start = esp_timer_get_time();
+        drive_frame(ctx);
 
-        for (int i = 0; i < NUM_RENDER_THREADS; i++) {
-            xSemaphoreTake(ctx->feed_done_smphr[i], portMAX_DELAY);
+        if (ctx->current_frame < EPD_STATS_FRAMES) {
+            ctx->stats.frame_time_us[ctx->current_frame] = esp_timer_get_time() - frame_start;
+        }
+        ctx->stats.frames++;
+
+        // the render threads prepared a table after their last line
+        finish_frame_function(ctx);
+
+        // lines that were not prepared in time have been output as no-ops.
+        // Give the render threads more time for the rest of the update, then drive them once more.
+        if (epd_lcd_missed_lines() > 0 && !ctx->error) {
+            if (!relieved) {
+                relieved = true;
+                epd_lcd_set_pixel_clock_MHz(pixel_clock_MHz * 3 / 4);
+                if (ctx->underrun_cb != NULL) {
+                    ctx->underrun_cb(true);
+                }
+            }
+            if (!redrive_missed_rows(ctx)) {
+                lines_lost = true;
+            }
         }
 
-        ctx->current_frame++;
+        // frames without ops for the shades in the image are skipped
+        ctx->current_frame = next_active_frame(ctx, ctx->current_frame + 1);
 
         // make the watchdog happy.
         vTaskDelay(0);
@@ -102,6 +209,25 @@ void lcd_do_update(RenderContext_t *ctx) {
 
     epd_lcd_line_source_cb(NULL, NULL);
     epd_lcd_frame_done_cb(NULL, NULL);
+    epd_lcd_set_row_range(0, ctx->display_height);
+    if (relieved) {
+        epd_lcd_set_pixel_clock_MHz(pixel_clock_MHz);
+        if (ctx->underrun_cb != NULL) {
+            ctx->underrun_cb(false);
+        }
+    }
+    epd_lcd_set_line_time(0);
+
+    // reported after the update, so the following frames are still rendered
+    if (lines_lost) {
+        ctx->error |= EPD_DRAW_EMPTY_LINE_QUEUE;
+    }
+
+    LcdEpdStats_t lcd_stats = epd_lcd_stats();
+    ctx->stats.min_lines_ahead = lcd_stats.min_lines_ahead;
+    ctx->stats.eof_interrupts = lcd_stats.eof_interrupts;
+    ctx->stats.eof_max_cycles = lcd_stats.eof_max_cycles;
+    ctx->stats.missed_lines = lcd_stats.missed_lines;
 
     set_mode(0);
 }
@@ -112,13 +238,12 @@ void epd_push_pixels_lcd(RenderContext_t *ctx, int color) {
     ctx->current_frame = 0;
     epd_lcd_frame_done_cb((frame_done_func_t)handle_lcd_frame_done, ctx);
     if (color == 0) {
-        epd_lcd_line_source_cb((line_cb_func_t)&fill_line_black, ctx);
+        epd_lcd_start_solid_frame(DARK_BYTE);
     } else if (color == 1) {
-        epd_lcd_line_source_cb((line_cb_func_t)&fill_line_white, ctx);
+        epd_lcd_start_solid_frame(CLEAR_BYTE);
     } else {
-        epd_lcd_line_source_cb((line_cb_func_t)&fill_line_noop, ctx);
+        epd_lcd_start_solid_frame(0x00);
     }
-    epd_lcd_start_frame();
     xSemaphoreTake(ctx->frame_done, portMAX_DELAY);
     set_mode(0);
 }
@@ -128,34 +253,138 @@ void render_stripe_frame(RenderContext_t *ctx){
     set_mode(1);
     ctx->current_frame = 0;
     epd_lcd_frame_done_cb((frame_done_func_t)handle_lcd_frame_done, ctx);
-    epd_lcd_line_source_cb((line_cb_func_t)&fill_line_stripe, ctx);
-    epd_lcd_start_frame();
+    epd_lcd_start_solid_frame(0B01011010);
     xSemaphoreTake(ctx->frame_done, portMAX_DELAY);
     set_mode(0);
 }
 
-#define int_min(a, b) (((a) < (b)) ? (a) : (b))
+
+static bool IRAM_ATTR row_fetched_cb(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *args) {
+    *(volatile bool *)args = true;
+    return false;
+}
+
+/**
+ * Start copying a framebuffer row into slot `slot` of the thread's line buffers.
+ */
+static void IRAM_ATTR fetch_row(RenderContext_t *ctx, int thread_id, int slot, int row_stride, const uint8_t *row, int bytes) {
+    uint8_t *dst = ctx->feed_line_buffers[thread_id] + slot * row_stride;
+    volatile bool *done = &ctx->row_fetched[thread_id][slot];
+
+    *done = false;
+    if (esp_async_memcpy(ctx->row_dma, dst, (void *)row, bytes, &row_fetched_cb, (void *)done) != ESP_OK) {
+        memcpy(dst, row, bytes);
+        *done = true;
+    }
+}
+
+/**
+ * Claim the next chunk of lines for `thread_id`: its own next chunk, or the next chunk
+ * of a thread that fell behind. Returns the chunk index, -1 if all chunks are claimed.
+ */
+static int IRAM_ATTR claim_chunk(RenderContext_t *ctx, int thread_id) {
+    int chunks = (ctx->lines_total - ctx->lines_first + RENDER_CHUNK_LINES - 1) / RENDER_CHUNK_LINES;
+
+    while (true) {
+        int target = -1;
+        int target_chunk = INT_MAX;
+        int own_chunk = thread_id + NUM_RENDER_THREADS * ctx->chunks_claimed[thread_id];
+        if (own_chunk < chunks) {
+            target = thread_id;
+            target_chunk = own_chunk;
+        }
+        for (int i = 1; i < NUM_RENDER_THREADS; i++) {
+            int t = (thread_id + i) % NUM_RENDER_THREADS;
+            int chunk = t + NUM_RENDER_THREADS * ctx->chunks_claimed[t];
+            if (chunk < chunks && (target < 0 || chunk + RENDER_STEAL_LAG < target_chunk)) {
+                target = t;
+                target_chunk = chunk;
+            }
+        }
+        if (target < 0) {
+            return -1;
+        }
+
+        // the owner or another thief may have been faster, then look again
+        int chunk = target + NUM_RENDER_THREADS * atomic_fetch_add(&ctx->chunks_claimed[target], 1);
+        if (chunk < chunks) {
+            if (target != thread_id) {
+                ctx->stats.chunks_stolen[thread_id]++;
+            }
+            return chunk;
+        }
+    }
+}
+
+/**
+ * Wait until the output of an earlier line releases the slot of `line`.
+ * Returns NULL if the line has to be dropped: the output already counted it
+ * as missed, or the slot was not released within `SLOT_WAIT_TIMEOUT_US`.
+ */
+static uint8_t *IRAM_ATTR wait_line_slot(int line, uint32_t *spins, uint32_t *timeouts) {
+    int64_t wait_start = 0;
+    uint8_t *buf = epd_lcd_line_slot(line);
+    while (buf == NULL) {
+        if (epd_lcd_line_released(line)) {
+            return NULL;
+        }
+        // the clock is only read now and then, most waits are short
+        if ((++*spins & 0x3FF) == 0) {
+            int64_t now = esp_timer_get_time();
+            if (wait_start == 0) {
+                wait_start = now;
+            } else if (now - wait_start > SLOT_WAIT_TIMEOUT_US) {
+                ++*timeouts;
+                return NULL;
+            }
+        }
+        buf = epd_lcd_line_slot(line);
+    }
+    return buf;
+}
+
+/// Lines outside of the vertical crop or not marked in `drawn_lines` are not drawn,
+/// neither are lines whose waveform does nothing in the current frame.
+static inline bool line_skipped(const RenderContext_t *ctx, int line, int min_y, int max_y) {
+    return line < min_y || line >= max_y
+        || (ctx->drawn_lines != NULL && !ctx->drawn_lines[line - ctx->area.y])
+        || (ctx->redrive_rows != NULL && !ctx->redrive_rows[line])
+        || (ctx->has_region && !ctx->waveform_active[ctx->row_waveform[line]]);
+}
+
+/**
+ * Turn the output of the pixels outside of columns `[x0, x1)` into no-ops.
+ */
+static inline void mask_columns(uint8_t *line, int x0, int x1, int line_bytes) {
+    memset(line, 0x00, x0 / 4);
+    if (x0 % 4) {
+        line[x0 / 4] &= 0xFF << (2 * (x0 % 4));
+    }
+    if (x1 % 4) {
+        line[x1 / 4] &= ~(0xFF << (2 * (x1 % 4)));
+    }
+    int right = (x1 + 3) / 4;
+    memset(line + right, 0x00, line_bytes - right);
+}
+
 __attribute__((optimize("O3")))
 void IRAM_ATTR lcd_calculate_frame(RenderContext_t *ctx, int thread_id) {
 
     uint8_t* input_line = ctx->feed_line_buffers[thread_id];
-    LineQueue_t *lq = &ctx->line_queues[thread_id];
     int l = 0;
 
     // if there is an error, start the frame but don't feed data.
     if (ctx->error) {
-        memset(ctx->line_threads, 0, ctx->lines_total);
-        epd_lcd_line_source_cb((line_cb_func_t)&retrieve_line_isr, ctx);
-        epd_lcd_start_frame();
-        ESP_LOGW("epd_lcd", "draw frame draw initiated, but an error flag is set: %X", ctx->error);
+        if (thread_id == 0) {
+            epd_lcd_line_source_cb((line_cb_func_t)&fill_line_noop, ctx);
+            epd_lcd_start_frame();
+            ESP_LOGW("epd_lcd", "draw frame draw initiated, but an error flag is set: %X", ctx->error);
+        }
         return;
     }
 
     //assert(input_calc_func != NULL);
 
-    // line must be able to hold 2-pixel-per-byte or 1-pixel-per-byte data
-    memset(input_line, 0x00, ctx->display_width/2);
-
     EpdRect area = ctx->area;
     int min_y, max_y, bytes_per_line, _ppB;
     const uint8_t *ptr_start;
@@ -163,63 +392,138 @@ void IRAM_ATTR lcd_calculate_frame(RenderContext_t *ctx, int thread_id) {
 
     assert(area.width == ctx->display_width && area.x == 0 && !ctx->error);
 
-    // index of the line that triggers the frame output when processed
-    int trigger_line = int_min(299, max_y - min_y);
-   // ESP_LOGI("trigger", "%d", trigger_line);
+    // full rows, horizontal cropping is done on the output
+    const uint8_t *first_row = ctx->data_ptr + (min_y - area.y) * bytes_per_line;
 
-    while (l = atomic_fetch_add(&ctx->lines_prepared, 1), l < ctx->lines_total) {
+    // drawn columns
+    int x0 = area.x + ctx->crop_to.x;
+    int x1 = int_min(x0 + ctx->crop_to.width, ctx->display_width);
+    bool horizontally_cropped = x0 > 0 || x1 < ctx->display_width;
 
-        ctx->line_threads[l] = thread_id;
+    // index of the line that triggers the frame output when processed,
+    // all earlier lines fit into the output ring
+    int trigger_line = ctx->lines_first + int_min(epd_lcd_ring_prefill(), ctx->lines_total - ctx->lines_first) - 1;
+   // ESP_LOGI("trigger", "%d", trigger_line);
 
-        // queue is sufficiently filled to fill both bounce buffers, frame
-        // can begin
-        if (l - min_y == trigger_line) {
-            epd_lcd_line_source_cb((line_cb_func_t)&retrieve_line_isr, ctx);
-            epd_lcd_start_frame();
-        }
-        /*
-        if (l < min_y || l >= max_y ||
-            (ctx->drawn_lines != NULL &&
-             !ctx->drawn_lines[l - area.y])) {
-            uint8_t *buf = NULL;
-            while (buf == NULL) {
-                // break in case of errors
-                if (ctx->error & EPD_DRAW_EMPTY_LINE_QUEUE) {
-                    printf("on err 1: %d %d\n", ctx->lines_prepared, ctx->lines_consumed);
-                    lq_reset(lq);
-                    return;
-                };
-
-                buf = lq_current(lq);
+    // Rows in PSRAM are copied to internal memory by DMA while earlier lines
+    // are calculated, so the kernels never wait for the cache.
+    // Uniform frames don't read the framebuffer at all.
+    // Rows of difference images are twice as long, half as many of them fit.
+    int row_stride = int_max(ctx->display_width / 2, bytes_per_line);
+    int depth = PREFETCH_ROWS * (ctx->display_width / 2) / row_stride;
+    bool prefetch = ctx->row_dma != NULL
+        && ctx->frame_func != &uniform_line_func
+        && esp_ptr_external_ram(first_row)
+        && depth > 0
+        && (((uintptr_t)first_row | bytes_per_line | row_stride) & 0xF) == 0;
+    if (!prefetch) {
+        depth = 1;
+    }
+
+    // lines claimed by this thread per buffer slot, -1 for free slots.
+    // They are calculated lowest first: lines of a chunk taken over from
+    // a thread that fell behind must not wait behind later lines for ring slots.
+    int claimed[PREFETCH_ROWS];
+    for (int i = 0; i < PREFETCH_ROWS; i++) {
+        claimed[i] = -1;
+    }
+    int count = 0;
+    bool all_claimed = false;
+    // remaining lines of the current chunk
+    int chunk_line = 0;
+    int chunk_end = 0;
+
+    // counted locally, the stats are shared with the other thread
+    uint32_t lines_rendered = 0;
+    uint32_t slot_spins = 0;
+    uint32_t slot_timeouts = 0;
+    uint32_t fetch_spins = 0;
+
+    while (true) {
+        while (!all_claimed && count < depth) {
+            if (chunk_line == chunk_end) {
+                int chunk = claim_chunk(ctx, thread_id);
+                if (chunk < 0) {
+                    all_claimed = true;
+                    break;
+                }
+                chunk_line = ctx->lines_first + chunk * RENDER_CHUNK_LINES;
+                chunk_end = int_min(chunk_line + RENDER_CHUNK_LINES, ctx->lines_total);
             }
-            memset(buf, 0x66, lq->element_size);
-            lq_commit(lq);
-            continue;
+            int next = chunk_line++;
+            int slot = 0;
+            while (claimed[slot] >= 0) {
+                slot++;
+            }
+            claimed[slot] = next;
+            if (prefetch && !line_skipped(ctx, next, min_y, max_y)) {
+                fetch_row(ctx, thread_id, slot, row_stride, first_row + bytes_per_line * (next - min_y), bytes_per_line);
+            }
+            count++;
+        }
+        if (count == 0) {
+            break;
         }
-        */
-        uint32_t *lp = (uint32_t *)input_line;
-        const uint8_t *ptr = ptr_start + bytes_per_line * (l - min_y);
-
-        Cache_Start_DCache_Preload((uint32_t)ptr, ctx->display_width, 0);
-
-        lp = (uint32_t *)ptr;
-
-        uint8_t *buf = NULL;
-        while (buf == NULL) {
-            // break in case of errors
-            if (ctx->error & EPD_DRAW_EMPTY_LINE_QUEUE) {
-                lq_reset(lq);
-                printf("on err 2: %d %d\n", ctx->lines_prepared, ctx->lines_consumed);
-                return;
-            };
 
-            buf = lq_current(lq);
+        int slot = -1;
+        for (int i = 0; i < depth; i++) {
+            if (claimed[i] >= 0 && (slot < 0 || claimed[i] < claimed[slot])) {
+                slot = i;
+            }
         }
+        l = claimed[slot];
+        claimed[slot] = -1;
+        count--;
+
+        // lines outside of the drawn area are output as no-ops by the driver
+        if (line_skipped(ctx, l, min_y, max_y)) {
+            if (wait_line_slot(l, &slot_spins, &slot_timeouts) != NULL) {
+                epd_lcd_line_skip(l);
+            }
+        } else {
+            const uint32_t *lp;
+            if (prefetch) {
+                while (!ctx->row_fetched[thread_id][slot]) {
+                    fetch_spins++;
+                }
+                lp = (const uint32_t *)(input_line + slot * row_stride);
+            } else {
+                const uint8_t *ptr = first_row + bytes_per_line * (l - min_y);
+                if (ctx->frame_func != &uniform_line_func) {
+                    Cache_Start_DCache_Preload((uint32_t)ptr, ctx->display_width, 0);
+                }
+                lp = (const uint32_t *)ptr;
+            }
 
-        custom_lut_func(lp, buf, ctx->conversion_lut, ctx->current_frame);
+            uint8_t *buf = wait_line_slot(l, &slot_spins, &slot_timeouts);
+            if (buf != NULL) {
+                if (ctx->has_region && ctx->row_waveform[l]) {
+                    (*ctx->region_func)(lp, buf, ctx->region_lut, ctx->current_frame);
+                } else {
+                    (*ctx->frame_func)(lp, buf, ctx->frame_lut, ctx->current_frame);
+                }
+                if (horizontally_cropped) {
+                    mask_columns(buf, x0, x1, ctx->display_width / 4);
+                }
+
+                epd_lcd_line_ready(l);
+                lines_rendered++;
+            }
+        }
 
-        lq_commit(lq);
+        // the ring is sufficiently filled, frame can begin.
+        // Only once the trigger line is in its slot: the frames of short
+        // row ranges end within the line groups linked at the start.
+        if (l == trigger_line) {
+            epd_lcd_line_source_cb(NULL, NULL);
+            epd_lcd_start_frame();
+        }
     }
+
+    ctx->stats.lines_rendered[thread_id] += lines_rendered;
+    ctx->stats.slot_wait_spins[thread_id] += slot_spins;
+    ctx->stats.slot_timeouts[thread_id] += slot_timeouts;
+    ctx->stats.fetch_wait_spins[thread_id] += fetch_spins;
 }
 
 
@@ -229,15 +533,15 @@ void IRAM_ATTR lcd_calculate_frame_sweep(RenderContext_t *ctx, int thread_id, in
 
     uint8_t* input_line = ctx->feed_line_buffers[thread_id];
 
-    LineQueue_t *lq = &ctx->line_queues[thread_id];
     int l = 0;
 
     // if there is an error, start the frame but don't feed data.
     if (ctx->error) {
-        memset(ctx->line_threads, 0, ctx->lines_total);
-        epd_lcd_line_source_cb((line_cb_func_t)&retrieve_line_isr, ctx);
-        epd_lcd_start_frame();
-        ESP_LOGW("epd_lcd", "draw frame draw initiated, but an error flag is set: %X", ctx->error);
+        if (thread_id == 0) {
+            epd_lcd_line_source_cb((line_cb_func_t)&fill_line_noop, ctx);
+            epd_lcd_start_frame();
+            ESP_LOGW("epd_lcd", "draw frame draw initiated, but an error flag is set: %X", ctx->error);
+        }
         return;
     }
 
@@ -253,55 +557,44 @@ void IRAM_ATTR lcd_calculate_frame_sweep(RenderContext_t *ctx, int thread_id, in
     assert(area.width == ctx->display_width && area.x == 0 && !ctx->error);
 
     // index of the line that triggers the frame output when processed
-    int trigger_line = int_min(191, max_y - min_y);
+    int trigger_line = int_min(epd_lcd_ring_prefill() - 1, max_y - min_y);
 
     while (l = atomic_fetch_add(&ctx->lines_prepared, 1), l < ctx->lines_total) {
 
-        ctx->line_threads[l] = thread_id;
-
-        // queue is sufficiently filled to fill both bounce buffers, frame
-        // can begin
+        // the ring is sufficiently filled, frame can begin
         if (l - min_y == trigger_line) {
-            epd_lcd_line_source_cb((line_cb_func_t)&retrieve_line_isr, ctx);
+            epd_lcd_line_source_cb(NULL, NULL);
             epd_lcd_start_frame();
         }
         
         if (l < min_y || l >= max_y ||
             (ctx->drawn_lines != NULL &&
              !ctx->drawn_lines[l - area.y])) {
-            uint8_t *buf = NULL;
-            while (buf == NULL) {
-                // break in case of errors
-                if (ctx->error & EPD_DRAW_EMPTY_LINE_QUEUE) {
-                    printf("on err 1: %d %d\n", ctx->lines_prepared, ctx->lines_consumed);
-                    lq_reset(lq);
-                    return;
-                };
-
-                buf = lq_current(lq);
+            uint32_t spins = 0, timeouts = 0;
+            uint8_t *buf = wait_line_slot(l, &spins, &timeouts);
+            if (buf == NULL) {
+                continue;
             }
-            memset(buf, 0x00, lq->element_size);
-            lq_commit(lq);
+            memset(buf, 0x00, ctx->display_width / 4);
+            epd_lcd_line_ready(l);
             continue;
         }
 
         uint32_t *lp = (uint32_t *)input_line;
         const uint8_t *ptr = ptr_start + bytes_per_line * (l - min_y);
 
-        Cache_Start_DCache_Preload((uint32_t)ptr, ctx->display_width, 0);
+        // uniform frames don't read the framebuffer
+        if (ctx->frame_func != &uniform_line_func) {
+            Cache_Start_DCache_Preload((uint32_t)ptr, ctx->display_width, 0);
+        }
 
         lp = (uint32_t *)ptr;
 
-        uint8_t *buf = NULL;
-        while (buf == NULL) {
-            // break in case of errors
-            if (ctx->error & EPD_DRAW_EMPTY_LINE_QUEUE) {
-                lq_reset(lq);
-                printf("on err 2: %d %d\n", ctx->lines_prepared, ctx->lines_consumed);
-                return;
-            };
-
-            buf = lq_current(lq);
+        uint32_t spins = 0, timeouts = 0;
+        uint8_t *buf = wait_line_slot(l, &spins, &timeouts);
+        if (buf == NULL) {
+            frame++;
+            continue;
         }
 
         //(*input_calc_func)(lp, buf, ctx->conversion_lut, ctx->display_width);
@@ -309,7 +602,7 @@ void IRAM_ATTR lcd_calculate_frame_sweep(RenderContext_t *ctx, int thread_id, in
         custom_lut_func(lp, buf, ctx->conversion_lut, frame);
         frame++;
 
-        lq_commit(lq);
+        epd_lcd_line_ready(l);
     }
 }
 
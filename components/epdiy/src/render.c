@@ -10,6 +10,10 @@
 #include <string.h>
 #include <esp_log.h>
 #include <esp_types.h>
+#include <esp_timer.h>
+#include <esp_cache.h>
+#include <esp_memory_utils.h>
+#include <esp_async_memcpy.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
@@ -73,6 +77,14 @@ static int get_waveform_index(const EpdWaveform *waveform,
 
 /////////////////////////////  API Procedures //////////////////////////////////
 
+/// Regions only apply to one draw, see `epd_set_region_mode()`.
+static void reset_regions() {
+    if (render_context.has_region) {
+        memset(render_context.row_waveform, 0, render_context.display_height);
+        render_context.has_region = false;
+    }
+}
+
 /// Rounded up display height for even division into multi-line buffers.
 static inline int rounded_display_height() {
     return (((epd_height() + 7) / 8) * 8);
@@ -87,10 +99,24 @@ enum EpdDrawError IRAM_ATTR epd_draw_base(
     
     int waveform_range = 1;
     int waveform_index = 0;
-    uint8_t frame_count = FRAMES;
     const EpdWaveformPhases *waveform_phases = NULL;
 
-    load_waveform();
+    // warmer panels need fewer frames
+    load_mode_waveform(mode, waveform_temp_range(temperature));
+
+    // only drive the frames of the waveform that do anything
+    // for the shades in the image
+    int first_frame = waveform_first_frame;
+    int frame_count = waveform_end_frame;
+    uint16_t shade_mask = render_context.shade_mask;
+    uint32_t frame_mask = waveform_frame_mask(shade_mask);
+    render_context.shade_mask = ALL_SHADES;
+    // transitions may drive frames in which the shades from white are idle
+    if (mode & MODE_PACKING_1PPB_DIFFERENCE) {
+        first_frame = 0;
+        frame_count = FRAMES;
+        frame_mask = transition_frame_mask();
+    }
 
     /*    // no waveform required for monochrome mode
     if (!(mode & MODE_EPDIY_MONOCHROME)) {
@@ -106,17 +132,40 @@ enum EpdDrawError IRAM_ATTR epd_draw_base(
     } else {
         frame_count = 1;
     }
+    */
 
     if (crop_to.width < 0 || crop_to.height < 0) {
+        reset_regions();
         return EPD_DRAW_INVALID_CROP;
     }
 
     const bool crop = (crop_to.width > 0 && crop_to.height > 0);
     if (crop && (crop_to.width > area.width || crop_to.height > area.height ||
                  crop_to.x > area.width || crop_to.y > area.height)) {
+        reset_regions();
         return EPD_DRAW_INVALID_CROP;
     }
-    */
+    // without a crop, the whole buffer is drawn
+    if (!crop) {
+        crop_to = (EpdRect){.x = 0, .y = 0, .width = area.width, .height = area.height};
+    }
+
+    // rows of the region follow a waveform of their own in the same frames
+    render_context.main_frame_mask = frame_mask;
+    if (render_context.has_region) {
+        bool difference = mode & MODE_PACKING_1PPB_DIFFERENCE;
+        if ((mode & MODE_PACKING_4PLANES)
+                || !load_region_waveform(render_context.region_mode, waveform_temp_range(temperature))) {
+            ESP_LOGW("epd", "no region waveform for mode %d, the region is drawn like the rest",
+                     render_context.region_mode & 0x3F);
+            reset_regions();
+        } else {
+            render_context.region_frame_mask = region_frame_mask(difference ? ALL_SHADES : shade_mask);
+            first_frame = 0;
+            frame_count = FRAMES;
+            frame_mask |= render_context.region_frame_mask;
+        }
+    }
 
     render_context.area = area;
     render_context.crop_to = crop_to;
@@ -127,21 +176,38 @@ enum EpdDrawError IRAM_ATTR epd_draw_base(
     render_context.error = EPD_DRAW_SUCCESS;
     render_context.drawn_lines = drawn_lines;
     render_context.data_ptr = data;
+    render_context.lut_func = get_lut_function(&render_context);
+
+    // rows are fetched from PSRAM by DMA, which doesn't see the data cache
+    if (render_context.row_dma != NULL && esp_ptr_external_ram(data)) {
+        int min_y, max_y, bytes_per_line, _ppB;
+        const uint8_t *ptr_start;
+        get_buffer_params(&render_context, &bytes_per_line, &ptr_start, &min_y, &max_y, &_ppB);
+        const uint8_t *first_row = data + (min_y - area.y) * bytes_per_line;
+        esp_cache_msync((void *)first_row, bytes_per_line * (max_y - min_y),
+                        ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_UNALIGNED);
+    }
 
     render_context.lines_prepared = 0;
-    render_context.lines_consumed = 0;
+    render_context.lines_first = 0;
+    memset(&render_context.stats, 0, sizeof(render_context.stats));
+    render_context.stats.min_lines_ahead = -1;
     render_context.lines_total = 1200;
-    render_context.current_frame = 0;
+    render_context.current_frame = first_frame;
     render_context.cycle_frames = frame_count;
-    render_context.phase_times = NULL;
+    render_context.frame_mask = frame_mask;
+    render_context.phase_times = frame_times;
     if (waveform_phases != NULL && waveform_phases->phase_times != NULL) {
         render_context.phase_times = waveform_phases->phase_times;
     }
 
-    //ESP_LOGI("epdiy", "starting update, phases: %d", frame_count);
+    //ESP_LOGI("epdiy", "starting update, phases: %d", frame_count - first_frame);
 
+    int64_t draw_start = esp_timer_get_time();
     lcd_do_update(&render_context);
     //lcd_do_update_sweep(&render_context);
+    render_context.stats.draw_time_us = esp_timer_get_time() - draw_start;
+    reset_regions();
 
 
     if (render_context.error != EPD_DRAW_SUCCESS) {
@@ -159,77 +225,113 @@ static void IRAM_ATTR render_thread(void* arg) {
 
         lcd_calculate_frame(&render_context, thread_id);
 
+        // Lines of this frame are all queued, prepare our part of
+        // the next needed lookup table while the frame is output.
+        int next_frame = render_context.lut_prepare_frame;
+        if (next_frame >= 0) {
+            calculate_lut_part(render_context.conversion_lut_back, next_frame, thread_id, NUM_RENDER_THREADS);
+        }
+
         xSemaphoreGive(render_context.feed_done_smphr[thread_id]);
     }
 }
 
 
 
+int epd_chunks_stolen() {
+    int stolen = 0;
+    for (int i = 0; i < NUM_RENDER_THREADS; i++) {
+        stolen += render_context.stats.chunks_stolen[i];
+    }
+    return stolen;
+}
+
+const EpdRenderStats* epd_render_stats() {
+    return &render_context.stats;
+}
+
+void epd_set_underrun_cb(void (*cb)(bool relieve)) {
+    render_context.underrun_cb = cb;
+}
+
 void epd_clear_area_cycles(EpdRect area, int cycles) {
     cycles = 1;
+    // colors of epd_push_pixels() for the ops of the clear sequence
+    const int op_colors[3] = {2, 0, 1};
     for (int c = 0; c < cycles; c++) {
-        for (int i = 0; i < 10; i++) {
-            epd_push_pixels(area, 0);
-        }
-        for (int i = 0; i < 10; i++) {
-            epd_push_pixels(area, 1);
-        }
-        for (int i = 0; i < 5; i++) {
-            epd_push_pixels(area, 2);
+        for (int i = 0; i < clear_frame_count; i++) {
+            epd_push_pixels(area, op_colors[clear_wave[i]]);
         }
     }
 }
 
-void epd_renderer_init() {
+void epd_renderer_init(enum EpdInitOptions options) {
 
     render_context.display_width = 1600;
     render_context.display_height = 1200;
 
+    render_context.shade_mask = ALL_SHADES;
+    render_context.conversion_lut = NULL;
+    render_context.conversion_lut_back = NULL;
+    render_context.conversion_lut_size = 0;
+    if (options & EPD_LUT_1K && !(options & EPD_LUT_DIRECT)) {
+        render_context.conversion_lut_size = LUT_1K_SIZE;
+        render_context.conversion_lut = (uint8_t *)heap_caps_malloc(
+            LUT_1K_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        assert(render_context.conversion_lut != NULL);
+    } else if (!(options & EPD_LUT_DIRECT)) {
+        // double buffered, so the next frame's table can be prepared during output
+        render_context.conversion_lut_size = LUT_64K_SIZE;
+        render_context.conversion_lut = (uint8_t *)heap_caps_malloc(
+            LUT_64K_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        render_context.conversion_lut_back = (uint8_t *)heap_caps_malloc(
+            LUT_64K_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        if (render_context.conversion_lut == NULL || render_context.conversion_lut_back == NULL) {
+            ESP_LOGW("epd", "could not allocate 64K lookup tables, falling back to direct lookup.");
+            heap_caps_free(render_context.conversion_lut);
+            heap_caps_free(render_context.conversion_lut_back);
+            render_context.conversion_lut = NULL;
+            render_context.conversion_lut_back = NULL;
+            render_context.conversion_lut_size = 0;
+        }
+    }
+
     render_context.frame_done = xSemaphoreCreateBinary();
 
+    render_context.redrive_rows = NULL;
+    render_context.redrive_buffer = (bool *)heap_caps_malloc(
+        render_context.display_height, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    assert(render_context.redrive_buffer != NULL);
+
+    render_context.has_region = false;
+    render_context.row_waveform = (uint8_t *)heap_caps_calloc(
+        render_context.display_height, 1, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    assert(render_context.row_waveform != NULL);
+
     for (int i = 0; i < NUM_RENDER_THREADS; i++) {
         render_context.feed_done_smphr[i] = xSemaphoreCreateBinary();
     }
 
-    // When using the LCD peripheral, we may need padding lines to
-    // satisfy the bounce buffer size requirements
-    render_context.line_threads = (uint8_t *)heap_caps_malloc(
-        1200, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
-
-
-    int queue_len = 150;
-
-    //size_t queue_elem_size = 400;
+    // framebuffer rows in PSRAM are fetched ahead of the render threads
+    async_memcpy_config_t row_dma_config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+    // leave room for transfers whose completion is not yet recycled by the driver
+    row_dma_config.backlog = 2 * NUM_RENDER_THREADS * PREFETCH_ROWS;
+    row_dma_config.sram_trans_align = 4;
+    row_dma_config.psram_trans_align = 16;
+    if (esp_async_memcpy_install(&row_dma_config, &render_context.row_dma) != ESP_OK) {
+        ESP_LOGW("epd", "could not install async memcpy, framebuffer rows are read in place.");
+        render_context.row_dma = NULL;
+    }
 
+    // lines are written directly to the output ring of the LCD driver
     for (int i = 0; i < NUM_RENDER_THREADS; i++) {
-/*
-        render_context.line_queues[i].size = queue_len;
-        render_context.line_queues[i].element_size = queue_elem_size;
-        render_context.line_queues[i].current = 0;
-        render_context.line_queues[i].last = 0;
-       // render_context.line_queues[i].buf = (uint8_t *)heap_caps_malloc(
-         //   queue_len * queue_elem_size, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
-       render_context.line_queues[i].buf = (uint8_t *)heap_caps_aligned_alloc(
-    16, // Alignment in bytes (32-byte alignment for DMA)
-    queue_len * queue_elem_size,
-    MALLOC_CAP_INTERNAL
-);
-*/
-
-        render_context.line_queues[i] = lq_init(queue_len);
-        
-        render_context.feed_line_buffers[i] = (uint8_t *)heap_caps_malloc(render_context.display_width, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        render_context.feed_line_buffers[i] = (uint8_t *)heap_caps_aligned_alloc(
+            16, PREFETCH_ROWS * render_context.display_width / 2,
+            MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
         assert(render_context.feed_line_buffers[i] != NULL);
         RTOS_ERROR_CHECK(xTaskCreatePinnedToCore(
             render_thread, "epd_prep", 1 << 11, (void *)i,
             configMAX_PRIORITIES-1, &render_context.feed_tasks[i], i));
-       
-       // if (render_context.line_queues[i].buf == NULL) {
-         //   ESP_LOGE("epd", "could not allocate line queue!");
-           // abort();
-        //}
-
-    
     }
 }
 
@@ -241,7 +343,6 @@ void epd_renderer_deinit() {
 
     for (int i = 0; i < NUM_RENDER_THREADS; i++) {
         vTaskDelete(render_context.feed_tasks[i]);
-        lq_free(&render_context.line_queues[i]);
         heap_caps_free(render_context.feed_line_buffers[i]);
         vSemaphoreDelete(render_context.feed_done_smphr[i]);
     }
@@ -252,8 +353,14 @@ void epd_renderer_deinit() {
         epd_board->deinit();
     }
 
+    if (render_context.row_dma != NULL) {
+        esp_async_memcpy_uninstall(render_context.row_dma);
+        render_context.row_dma = NULL;
+    }
     heap_caps_free(render_context.conversion_lut);
-    heap_caps_free(render_context.line_threads);
+    heap_caps_free(render_context.conversion_lut_back);
+    heap_caps_free(render_context.redrive_buffer);
+    heap_caps_free(render_context.row_waveform);
    // heap_caps_free(render_context.line_mask);
     vSemaphoreDelete(render_context.frame_done);
     /*
@@ -268,77 +375,124 @@ void epd_renderer_deinit() {
     }
 
     for (int i = 0; i < NUM_RENDER_THREADS; i++) {
-        free(render_context.line_queues[i].buf);
         free(render_context.feed_line_buffers[i]);
         vSemaphoreDelete(render_context.feed_done_smphr[i]);
         vTaskDelete(render_context.feed_tasks[i]);
     }
 
     free(render_context.conversion_lut);
-    free(render_context.line_threads);
     vSemaphoreDelete(render_context.frame_done);
     */
 }
 
+/// Spread the 4 pixels in the low 16 bits of a 4-bpp word to one byte each.
+static inline uint32_t spread_nibbles(uint32_t x) {
+    x = (x | (x << 8)) & 0x00FF00FF;
+    return (x | (x << 4)) & 0x0F0F0F0F;
+}
+
 EpdRect epd_difference_image_base(const uint8_t *to, const uint8_t *from,
                                   EpdRect crop_to, int fb_width, int fb_height,
                                   uint8_t *interlaced, bool *dirty_lines,
                                   uint8_t *from_or, uint8_t *from_and) {
     assert(from_or != NULL);
     assert(from_and != NULL);
-    // OR over all pixels of the "from"-image
-    *from_or = 0x00;
-    // AND over all pixels of the "from"-image
-    *from_and = 0x0F;
-
-    uint8_t* dirty_cols = calloc(epd_width(), 1);
-    assert (dirty_cols != NULL);
 
+    int x_start = max(crop_to.x, 0);
+    int y_start = max(crop_to.y, 0);
     int x_end = min(fb_width, crop_to.x + crop_to.width);
     int y_end = min(fb_height, crop_to.y + crop_to.height);
 
-    for (int y = crop_to.y; y < y_end; y++) {
-        uint8_t dirty = 0;
-        for (int x = crop_to.x; x < x_end; x++) {
-            uint8_t t = *(to + y * fb_width / 2 + x / 2);
-            t = (x % 2) ? (t >> 4) : (t & 0x0f);
-            uint8_t f = *(from + y * fb_width / 2 + x / 2);
-            f = (x % 2) ? (f >> 4) : (f & 0x0f);
-            *from_or |= f;
-            *from_and &= f;
-            dirty |= (t ^ f);
-            dirty_cols[x] |= (t ^ f);
-            interlaced[y * fb_width + x] = (t << 4) | f;
-        }
-        dirty_lines[y] = dirty > 0;
-    }
-    int min_x, min_y, max_x, max_y;
-    for (min_x = crop_to.x; min_x < x_end; min_x++) {
-        if (dirty_cols[min_x] != 0)
-            break;
-    }
-    for (max_x = x_end - 1; max_x >= crop_to.x; max_x--) {
-        if (dirty_cols[max_x] != 0)
-            break;
-    }
-    for (min_y = crop_to.y; min_y < y_end; min_y++) {
-        if (dirty_lines[min_y] != 0)
-            break;
+    // Whole words of 8 pixels are compared at once, the pixels before and after
+    // them one by one. Buffers and rows must start at word boundaries for this.
+    bool aligned = (((uintptr_t)to | (uintptr_t)from | (uintptr_t)interlaced) & 3) == 0;
+    int word_start = x_end;
+    int word_end = x_end;
+    if (aligned && fb_width % 8 == 0 && x_start < x_end) {
+        word_start = min((x_start + 7) / 8 * 8, x_end);
+        word_end = max(x_end / 8 * 8, word_start);
     }
-    for (max_y = y_end - 1; max_y >= crop_to.y; max_y--) {
-        if (dirty_lines[max_y] != 0)
-            break;
+
+    // OR and AND over all pixels of the "from"-image, per nibble
+    uint32_t or_word = 0x00000000;
+    uint32_t and_word = 0xFFFFFFFF;
+    uint8_t or_pixels = 0x00;
+    uint8_t and_pixels = 0x0F;
+
+    int min_x = x_end;
+    int max_x = x_start - 1;
+    int min_y = y_end;
+    int max_y = y_start - 1;
+
+    for (int y = y_start; y < y_end; y++) {
+        const uint8_t *to_row = to + y * fb_width / 2;
+        const uint8_t *from_row = from + y * fb_width / 2;
+        uint8_t *out = interlaced + y * fb_width;
+        uint32_t dirty = 0;
+
+        for (int x = x_start; x < x_end; x++) {
+            if (x == word_start) {
+                x = word_end;
+                if (x == x_end) {
+                    break;
+                }
+            }
+            uint8_t t = (x % 2) ? (to_row[x / 2] >> 4) : (to_row[x / 2] & 0x0F);
+            uint8_t f = (x % 2) ? (from_row[x / 2] >> 4) : (from_row[x / 2] & 0x0F);
+            or_pixels |= f;
+            and_pixels &= f;
+            if (t != f) {
+                dirty = 1;
+                min_x = min(min_x, x);
+                max_x = max(max_x, x);
+            }
+            out[x] = (t << 4) | f;
+        }
+
+        const uint32_t *to_words = (const uint32_t *)(to_row + word_start / 2);
+        const uint32_t *from_words = (const uint32_t *)(from_row + word_start / 2);
+        uint32_t *out_words = (uint32_t *)(out + word_start);
+        for (int x = word_start; x < word_end; x += 8) {
+            uint32_t t = *(to_words++);
+            uint32_t f = *(from_words++);
+            uint32_t diff = t ^ f;
+            or_word |= f;
+            and_word &= f;
+
+            // bit 4i is the lowest of pixel i
+            if (diff) {
+                dirty = 1;
+                min_x = min(min_x, x + __builtin_ctz(diff) / 4);
+                max_x = max(max_x, x + (31 - __builtin_clz(diff)) / 4);
+            }
+            *(out_words++) = spread_nibbles(f & 0xFFFF) | (spread_nibbles(t & 0xFFFF) << 4);
+            *(out_words++) = spread_nibbles(f >> 16) | (spread_nibbles(t >> 16) << 4);
+        }
+
+        dirty_lines[y] = dirty;
+        if (dirty) {
+            min_y = min(min_y, y);
+            max_y = y;
+        }
     }
+
+    // fold the nibbles of the words into the pixel results
+    or_word |= or_word >> 16;
+    or_word |= or_word >> 8;
+    or_word |= or_word >> 4;
+    and_word &= and_word >> 16;
+    and_word &= and_word >> 8;
+    and_word &= and_word >> 4;
+    *from_or = (or_pixels | or_word) & 0x0F;
+    *from_and = and_pixels & and_word & 0x0F;
+
     EpdRect crop_rect = {
         .x = min_x,
         .y = min_y,
         .width = max(max_x - min_x + 1, 0),
         .height = max(max_y - min_y + 1, 0),
     };
-
-    free(dirty_cols);
     return crop_rect;
-    
 }
 
 EpdRect epd_difference_image(const uint8_t *to, const uint8_t *from,
@@ -368,6 +522,68 @@ EpdRect epd_difference_image_cropped(const uint8_t *to, const uint8_t *from,
     return result;
 }
 
+/// Gather bit `plane` of the 8 pixels in `word` into every other bit of the low 16 bits.
+static inline uint32_t gather_plane_bits(uint32_t word, int plane) {
+    uint32_t x = (word >> plane) & 0x11111111;
+    x = (x | (x >> 2)) & 0x05050505;
+    x = (x | (x >> 4)) & 0x00550055;
+    return (x | (x >> 8)) & 0x5555;
+}
+
+void epd_pack_bitplanes(uint8_t *framebuffer, int width, int height) {
+    assert(width % 32 == 0);
+
+    uint32_t *block = (uint32_t *)framebuffer;
+    int blocks = width / 32 * height;
+
+    for (int i = 0; i < blocks; i++) {
+        uint32_t planes[4] = {0};
+        for (int w = 0; w < 4; w++) {
+            // pixels 0-15 go to the even, pixels 16-31 to the odd bits
+            int shift = (w & 1) * 16 + (w >> 1);
+            for (int p = 0; p < 4; p++) {
+                planes[p] |= gather_plane_bits(block[w], p) << shift;
+            }
+        }
+        memcpy(block, planes, sizeof(planes));
+        block += 4;
+    }
+}
+
+uint16_t epd_shade_mask(const uint8_t *framebuffer, int width, int height) {
+    bool seen[256] = {false};
+    int bytes = (width / 2 + width % 2) * height;
+
+    for (int i = 0; i < bytes; i++) {
+        seen[framebuffer[i]] = true;
+    }
+
+    uint16_t mask = 0;
+    for (int b = 0; b < 256; b++) {
+        if (seen[b]) {
+            mask |= (1 << (b & 0x0F)) | (1 << (b >> 4));
+        }
+    }
+    return mask;
+}
+
+void epd_set_shade_mask(uint16_t shade_mask) {
+    render_context.shade_mask = shade_mask;
+}
+
+void epd_set_region_mode(int y, int height, enum EpdDrawMode mode) {
+    if (render_context.has_region && render_context.region_mode != mode) {
+        ESP_LOGW("epd", "regions of a draw share one mode, mode %d replaces %d",
+                 mode & 0x3F, render_context.region_mode & 0x3F);
+    }
+    int end = min(y + height, render_context.display_height);
+    for (int row = max(y, 0); row < end; row++) {
+        render_context.row_waveform[row] = 1;
+    }
+    render_context.region_mode = mode;
+    render_context.has_region = true;
+}
+
 void render_stripes(){
     render_stripe_frame(&render_context);
 }
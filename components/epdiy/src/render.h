@@ -4,7 +4,7 @@
 /**
  * Initialize the EPD renderer and its render context.
  */
-void epd_renderer_init();
+void epd_renderer_init(enum EpdInitOptions options);
 
 /**
  * Deinitialize the EPD renderer and free up its resources.
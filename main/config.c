@@ -9,6 +9,8 @@
 #include <freertos/task.h>
 #include "nvs_flash.h"
 #include "button.h"
+#include "lcd_tune.h"
+#include "wifi.h"
 
 #include "../components/epdiy/src/output_lcd/lcd_driver.h"
 #include "../components/epdiy/src/epd_internals.h"
@@ -23,6 +25,7 @@ LcdEpdConfig_t lcd_config;
 TPS_t tps;
 int32_t SERIAL_NUMBER;  // Definition
 int32_t VCOM;  // Definition
+int8_t panel_temperature = 25;
 
 static lcd_bus_config_t lcd_bus = {
     .clock = XCL,
@@ -30,6 +33,7 @@ static lcd_bus_config_t lcd_bus = {
     .leh = XLE,
     .start_pulse = XSTL,
     .stv = SPV,
+    .oe = XOE,
     .data_0 = D0,
     .data_1 = D1,
     .data_2 = D2,
@@ -112,9 +116,13 @@ void renderer_init(){
     lcd_config.le_high_time = 4;
     lcd_config.bus_width = 8;
     lcd_config.bus = lcd_bus;
+    lcd_config.ring_prefill = LCD_RING_LINES;
+    // this unit's own limits, if they were measured
+    lcd_tune_load(&lcd_config);
 
     epd_lcd_init(&lcd_config, display.width, display.height);
-    epd_renderer_init();
+    epd_renderer_init(EPD_RENDER_OPTIONS);
+    epd_set_underrun_cb(wifi_throttle);
     hl_state = epd_hl_init(display.default_waveform);
 
     already_initialized = true;
@@ -232,6 +240,13 @@ void board_poweron(epd_ctrl_state_t *state) {
 
     //ESP_LOGI("epdiy", "Power good status achieved after %d tries", tries);
 
+    // selects the waveform, keeps the last value if the sensor does not answer
+    int8_t temperature;
+    if (tps_read_thermistor(&tps, &temperature) == ESP_OK) {
+        panel_temperature = temperature;
+    }
+    ESP_LOGI("POWERON", "panel temperature: %d C", panel_temperature);
+
     ESP_LOGI("POWERON", "done");
     vTaskDelay(1);
 }
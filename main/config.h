@@ -108,7 +108,18 @@
 */
 #define I2C_PORT  I2C_NUM_0
 
+// epdiy renderer options: EPD_LUT_64K uses double-buffered lookup tables,
+// EPD_LUT_DIRECT the reference kernel (e.g. to compare draw times).
+#define EPD_RENDER_OPTIONS EPD_LUT_64K
+
+// Transpose downloaded images to bit planes (MODE_PACKING_4PLANES) before drawing.
+// Leave disabled if other code draws into the framebuffer as 4-bpp afterwards (e.g. text.c).
+// Not supported by the refresh policy, which compares the 4-bpp framebuffers.
+#define EPD_USE_BITPLANES 0
+
 extern int32_t VCOM;
+// panel temperature in °C, read at power on
+extern int8_t panel_temperature;
 extern int32_t SERIAL_NUMBER;
 extern const int que_len;
 extern const int lut_size;
@@ -5,6 +5,8 @@
 #include "sd_card.h"
 #include "download.h"
 #include "wifi.h"
+#include "panel_state.h"
+#include "refresh_policy.h"
 #include <string.h>
 
 
@@ -18,6 +20,9 @@ EpdRect full_area = {.x = 0, .y = 0, .width = 1600, .height = 1200};
 void clear(){
     ESP_LOGI("Clearing", "...");
     epd_clear_area_cycles(full_area, 2);
+    // the framebuffers no longer match the panel
+    hl_state.back_fb_valid = false;
+    panel_state_unknown();
 }
 
 static uint8_t current_idx = 3;
@@ -108,8 +113,6 @@ bool get_from_flash(uint8_t* framebuffer, size_t framebuffer_size, uint32_t inde
 void display_image(char* filename) {
     //disable_wifi();
     renderer_init();
-    board_poweron(&ctrl_state);
-    clear();
     ESP_LOGI("Displaying image", "%s", filename);
     size_t framebuffer_size = 1600 / 2 * 1200;
     uint8_t* framebuffer = epd_hl_get_framebuffer(&hl_state);
@@ -121,13 +124,25 @@ void display_image(char* filename) {
 
    // char filename[MAX_FILENAME_LENGTH];
    // get_name_nvs(index, filename);
+
+    // the image on the panel is the "from" image of a partial update
+    refresh_policy_prepare(&hl_state);
     
     if (!get_from_sd(framebuffer, framebuffer_size, filename)) {
         ESP_LOGE("display_image", "Failed to get data from SD");
         return;
     }
 
-    enum EpdDrawError _err = epd_hl_update_screen(&hl_state, MODE_GC16, 25);
+    // e.g. a timer wake with an unchanged queue, the panel keeps its image without power
+    uint32_t image_hash = panel_image_hash(framebuffer);
+    if (panel_shows(image_hash)) {
+        ESP_LOGI("display_image", "%s is already displayed", filename);
+        return;
+    }
+    board_poweron(&ctrl_state);
+
+    // partial or full, depending on the ghosting the panel has accumulated
+    enum EpdDrawError _err = refresh_policy_update(&hl_state, panel_temperature, filename, image_hash);
 
     if (_err != EPD_DRAW_SUCCESS) {
         ESP_LOGE("display_image", "Failed to update screen: %d", _err);
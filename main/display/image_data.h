@@ -11,6 +11,7 @@
 
 extern EpdRect full_area;
 
+bool get_from_sd(uint8_t* framebuffer, size_t framebuffer_size, char* filename);
 bool get_from_flash(uint8_t* framebuffer, size_t framebuffer_size, uint32_t index);
 bool write_to_flash(const char* filename, const uint8_t* data, uint32_t index);
 void display_image(char* filename);
@@ -0,0 +1,161 @@
+#include "lcd_tune.h"
+#include "config.h"
+#include "image_data.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_app_desc.h"
+#include <string.h>
+
+static const char *TAG = "LCD_TUNE";
+
+#define NVS_NAMESPACE "storage"
+
+// Candidates, fastest first
+static const int tune_clocks_MHz[] = {24, 20, 18, 16, 14, 12, 10};
+static const int tune_prefills[] = {32, 64, LCD_RING_LINES};
+
+// Draws per candidate, all of them must pass
+#define TUNE_DRAWS 2
+// Lines that must stay ready ahead of the output, headroom for PSRAM and Wi-Fi load
+#define TUNE_MARGIN_LINES 16
+
+// Tunings are kept apart by the firmware that found them
+static void firmware_key(uint8_t key[8]) {
+    memcpy(key, esp_app_get_description()->app_elf_sha256, 8);
+}
+
+// ESP_ERR_INVALID_VERSION if the stored tuning is from other firmware
+static esp_err_t get_tuning_nvs(lcd_tuning_t *tuning) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t size = sizeof(lcd_tuning_t);
+    err = nvs_get_blob(nvs_handle, NVS_LCD_TUNE_KEY, tuning, &size);
+    if (err == ESP_OK && size != sizeof(lcd_tuning_t)) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    nvs_close(nvs_handle);
+    // records of older firmware are shorter and fail above
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t key[8];
+    firmware_key(key);
+    if (tuning->version != LCD_TUNE_VERSION || memcmp(tuning->firmware, key, sizeof(key)) != 0) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t set_tuning_nvs(lcd_tuning_t *tuning) {
+    tuning->version = LCD_TUNE_VERSION;
+    firmware_key(tuning->firmware);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(nvs_handle, NVS_LCD_TUNE_KEY, tuning, sizeof(lcd_tuning_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save tuning: %s", esp_err_to_name(err));
+    }
+
+    nvs_close(nvs_handle);
+    return err;
+}
+
+esp_err_t lcd_tune_load(LcdEpdConfig_t *config) {
+    lcd_tuning_t tuning;
+    esp_err_t err = get_tuning_nvs(&tuning);
+    if (err == ESP_ERR_INVALID_VERSION) {
+        ESP_LOGI(TAG, "Stored tuning is from other firmware, keeping the defaults until tuned again");
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    // the last run found no working candidate, keep the defaults
+    if (tuning.pixel_clock_MHz == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    config->pixel_clock = tuning.pixel_clock_MHz * 1000 * 1000;
+    config->ring_prefill = tuning.ring_prefill;
+    ESP_LOGI(TAG, "Pixel clock %d MHz, %d lines prefilled", tuning.pixel_clock_MHz, tuning.ring_prefill);
+    return ESP_OK;
+}
+
+// Draw the framebuffer with the current settings, true if no line was late
+static bool candidate_passes(const uint8_t *framebuffer) {
+    EpdRect no_crop = {0};
+    for (int i = 0; i < TUNE_DRAWS; i++) {
+        enum EpdDrawError err = epd_draw_base(full_area, framebuffer, no_crop, MODE_GC16 | MODE_PACKING_2PPB, 25, NULL, display.default_waveform);
+        const EpdRenderStats *stats = epd_render_stats();
+        ESP_LOGI(TAG, "%d missed lines, at least %d lines ahead", stats->missed_lines, stats->min_lines_ahead);
+        if (err != EPD_DRAW_SUCCESS || stats->missed_lines > 0
+                || (stats->min_lines_ahead >= 0 && stats->min_lines_ahead < TUNE_MARGIN_LINES)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t lcd_tune_run(bool force) {
+    lcd_tuning_t tuning;
+    if (!force && get_tuning_nvs(&tuning) == ESP_OK) {
+        return ESP_OK;
+    }
+
+    // the sweep draws real frames, they must not reach the panel
+    if (config_reg.pwrup) {
+        ESP_LOGW(TAG, "Panel supply is on, powering off before tuning");
+        board_poweroff(&ctrl_state);
+    }
+
+    renderer_init();
+    // the current image, so the frames cost what real updates cost
+    const uint8_t *framebuffer = epd_hl_get_framebuffer(&hl_state);
+    int prev_clock_MHz = epd_lcd_pixel_clock_MHz();
+    int prev_prefill = epd_lcd_ring_prefill();
+
+    for (int c = 0; c < sizeof(tune_clocks_MHz) / sizeof(tune_clocks_MHz[0]); c++) {
+        epd_lcd_set_pixel_clock_MHz(tune_clocks_MHz[c]);
+
+        for (int p = 0; p < sizeof(tune_prefills) / sizeof(tune_prefills[0]); p++) {
+            ESP_LOGI(TAG, "Trying %d MHz, %d lines prefilled", tune_clocks_MHz[c], tune_prefills[p]);
+            epd_lcd_set_ring_prefill(tune_prefills[p]);
+
+            if (candidate_passes(framebuffer)) {
+                tuning.pixel_clock_MHz = tune_clocks_MHz[c];
+                tuning.ring_prefill = tune_prefills[p];
+                ESP_LOGI(TAG, "Using %d MHz, %d lines prefilled", tuning.pixel_clock_MHz, tuning.ring_prefill);
+                return set_tuning_nvs(&tuning);
+            }
+        }
+    }
+
+    ESP_LOGE(TAG, "No candidate drew without missed lines, keeping %d MHz, %d lines prefilled",
+             prev_clock_MHz, prev_prefill);
+    epd_lcd_set_pixel_clock_MHz(prev_clock_MHz);
+    epd_lcd_set_ring_prefill(prev_prefill);
+
+    // so the sweep is not repeated on every wake, only when forced
+    tuning.pixel_clock_MHz = 0;
+    tuning.ring_prefill = 0;
+    set_tuning_nvs(&tuning);
+    return ESP_FAIL;
+}
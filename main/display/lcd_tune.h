@@ -0,0 +1,33 @@
+#ifndef LCD_TUNE_H
+#define LCD_TUNE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "../../components/epdiy/src/output_lcd/lcd_driver.h"
+
+#define NVS_LCD_TUNE_KEY "lcd_tune"
+// Bump when the output timing changes in a way that invalidates stored tunings
+#define LCD_TUNE_VERSION 1
+
+// Output settings found by lcd_tune_run(), a pixel clock of 0 records a failed run.
+// Only valid for the firmware that found them, other firmware tunes again.
+typedef struct {
+    uint32_t version;
+    // first bytes of the ELF SHA-256 of the tuned firmware
+    uint8_t firmware[8];
+    int pixel_clock_MHz;
+    int ring_prefill;
+} lcd_tuning_t;
+
+// Apply the stored tuning to config, before epd_lcd_init().
+// Leaves config unchanged if the unit was never tuned by this firmware.
+esp_err_t lcd_tune_load(LcdEpdConfig_t *config);
+
+// Find the fastest pixel clock and ring prefill that draw without missed lines and store them.
+// Only runs if no tuning or failed run of this firmware is stored, unless force is set.
+// Restores the previous settings if no candidate passes.
+// Powers the panel supply off first if it is on, so the display does not change.
+esp_err_t lcd_tune_run(bool force);
+
+#endif // LCD_TUNE_H
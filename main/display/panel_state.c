@@ -0,0 +1,156 @@
+#include "panel_state.h"
+#include "image_data.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "PANEL_STATE";
+
+#define PANEL_STATE_VERSION 2
+#define FRAMEBUFFER_SIZE (1600 / 2 * 1200)
+
+// survives deep sleep, NVS only backs it up across power loss.
+// Copied with memcpy, so the padding bytes covered by the CRC stay the same.
+RTC_NOINIT_ATTR static panel_state_t rtc_panel_state;
+static panel_state_t panel_state;
+static bool panel_state_loaded = false;
+
+static uint32_t panel_state_crc(const panel_state_t *state) {
+    return esp_rom_crc32_le(0, (const uint8_t *)state, offsetof(panel_state_t, crc));
+}
+
+static bool panel_state_valid(const panel_state_t *state) {
+    return state->version == PANEL_STATE_VERSION && state->crc == panel_state_crc(state);
+}
+
+static esp_err_t get_panel_state_nvs(panel_state_t *state) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t size = sizeof(panel_state_t);
+    err = nvs_get_blob(nvs_handle, NVS_PANEL_STATE_KEY, state, &size);
+    if (err == ESP_OK && (size != sizeof(panel_state_t) || !panel_state_valid(state))) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    nvs_close(nvs_handle);
+    return err;
+}
+
+static esp_err_t set_panel_state_nvs(const panel_state_t *state) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(nvs_handle, NVS_PANEL_STATE_KEY, state, sizeof(panel_state_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save panel state: %s", esp_err_to_name(err));
+    }
+
+    nvs_close(nvs_handle);
+    return err;
+}
+
+static void load_panel_state(void) {
+    if (panel_state_loaded) {
+        return;
+    }
+
+    // only cold boots read NVS
+    if (panel_state_valid(&rtc_panel_state)) {
+        memcpy(&panel_state, &rtc_panel_state, sizeof(panel_state_t));
+    } else if (get_panel_state_nvs(&panel_state) == ESP_OK) {
+        memcpy(&rtc_panel_state, &panel_state, sizeof(panel_state_t));
+    } else {
+        memset(&panel_state, 0, sizeof(panel_state));
+        panel_state.version = PANEL_STATE_VERSION;
+        panel_state.crc = panel_state_crc(&panel_state);
+    }
+    panel_state_loaded = true;
+    ESP_LOGI(TAG, "Panel shows %s (%08" PRIx32 "), %" PRIu32 " updates since the last clear",
+             panel_state.known ? panel_state.filename : "<unknown>", panel_state.image_hash, panel_state.partial_updates);
+}
+
+static esp_err_t save_panel_state(void) {
+    panel_state.crc = panel_state_crc(&panel_state);
+    memcpy(&rtc_panel_state, &panel_state, sizeof(panel_state_t));
+    return set_panel_state_nvs(&panel_state);
+}
+
+uint32_t panel_image_hash(const uint8_t *framebuffer) {
+    return esp_rom_crc32_le(0, framebuffer, FRAMEBUFFER_SIZE);
+}
+
+const panel_state_t *panel_state_get(void) {
+    load_panel_state();
+    return &panel_state;
+}
+
+bool panel_shows(uint32_t image_hash) {
+    load_panel_state();
+    return panel_state.known && panel_state.image_hash == image_hash;
+}
+
+bool panel_state_restore(EpdiyHighlevelState *state) {
+    // the back framebuffer already follows the panel since this boot
+    if (state->back_fb_valid) {
+        return true;
+    }
+
+    load_panel_state();
+    if (!panel_state.known || panel_state.filename[0] == '\0') {
+        return false;
+    }
+    if (!get_from_sd(state->back_fb, FRAMEBUFFER_SIZE, panel_state.filename)) {
+        return false;
+    }
+    if (panel_image_hash(state->back_fb) != panel_state.image_hash) {
+        ESP_LOGW(TAG, "%s changed since it was displayed", panel_state.filename);
+        return false;
+    }
+
+    memcpy(state->front_fb, state->back_fb, FRAMEBUFFER_SIZE);
+    state->back_fb_valid = true;
+    return true;
+}
+
+esp_err_t panel_state_displayed(const char *filename, uint32_t image_hash, bool full) {
+    load_panel_state();
+    panel_state.known = true;
+    memset(panel_state.filename, 0, MAX_FILENAME_LENGTH);
+    if (filename != NULL) {
+        strncpy(panel_state.filename, filename, MAX_FILENAME_LENGTH - 1);
+    }
+    panel_state.image_hash = image_hash;
+    panel_state.partial_updates = full ? 0 : panel_state.partial_updates + 1;
+    if (full) {
+        panel_state.last_full_clear = time(NULL);
+    }
+    return save_panel_state();
+}
+
+esp_err_t panel_state_unknown(void) {
+    load_panel_state();
+    if (!panel_state.known) {
+        return ESP_OK;
+    }
+    panel_state.known = false;
+    memset(panel_state.filename, 0, MAX_FILENAME_LENGTH);
+    panel_state.image_hash = 0;
+    return save_panel_state();
+}
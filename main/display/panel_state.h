@@ -0,0 +1,49 @@
+#ifndef PANEL_STATE_H
+#define PANEL_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "image_queue.h"
+#include "../../components/epdiy/src/epd_highlevel.h"
+
+#define NVS_PANEL_STATE_KEY "panel_state"
+
+// What the panel physically shows, kept in RTC memory across deep sleep and in NVS
+typedef struct {
+    uint32_t version;
+    // false if the content is uncertain, e.g. after a failed update
+    bool known;
+    // image file on the SD card, empty if the content can't be reloaded (e.g. text overlays)
+    char filename[MAX_FILENAME_LENGTH];
+    // see panel_image_hash()
+    uint32_t image_hash;
+    // updates since the last full clear
+    uint32_t partial_updates;
+    // system time of the last full clear in seconds, see time()
+    int64_t last_full_clear;
+    uint32_t crc;
+} panel_state_t;
+
+// Identity of a 4-bpp framebuffer of the display size
+uint32_t panel_image_hash(const uint8_t *framebuffer);
+
+// The current panel state, read from RTC memory or NVS on first use.
+const panel_state_t *panel_state_get(void);
+
+// True if the panel shows the image with this hash, so drawing it changes nothing.
+bool panel_shows(uint32_t image_hash);
+
+// Reload the displayed image from the SD card as back framebuffer of state and copy it
+// to the front one, so the next update only drives the pixels that change.
+// Returns false if the content is unknown or its file changed meanwhile.
+bool panel_state_restore(EpdiyHighlevelState *state);
+
+// Record a successful update. filename is NULL if the content can't be reloaded,
+// full if the update cleared the panel first.
+esp_err_t panel_state_displayed(const char *filename, uint32_t image_hash, bool full);
+
+// Forget the panel content, e.g. after a failed update.
+esp_err_t panel_state_unknown(void);
+
+#endif // PANEL_STATE_H
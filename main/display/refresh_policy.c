@@ -0,0 +1,195 @@
+#include "refresh_policy.h"
+#include "panel_state.h"
+#include "config.h"
+#include "../../components/epdiy/src/output_common/lut.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "REFRESH_POLICY";
+
+// Partial updates compare against the displayed image, which bit planes would destroy
+#if EPD_USE_BITPLANES
+#error "the refresh policy needs the 2PPB framebuffer, set EPD_USE_BITPLANES to 0"
+#endif
+
+#define FRAMEBUFFER_SIZE (1600 / 2 * 1200)
+#define PIXELS (1600 * 1200)
+
+static refresh_policy_t policy = {
+    .max_partial_updates = 5,
+    .max_changed_permille = 300,
+    .min_temperature = 10,
+    .max_age_s = 24 * 60 * 60,
+};
+static bool policy_loaded = false;
+
+static void load_policy(void) {
+    if (policy_loaded) {
+        return;
+    }
+    policy_loaded = true;
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    // the defaults stay if the server never pushed thresholds
+    refresh_policy_t stored;
+    size_t size = sizeof(refresh_policy_t);
+    if (nvs_get_blob(nvs_handle, NVS_REFRESH_POLICY_KEY, &stored, &size) == ESP_OK && size == sizeof(refresh_policy_t)) {
+        policy = stored;
+    }
+    nvs_close(nvs_handle);
+}
+
+static esp_err_t set_policy_nvs(const refresh_policy_t *stored) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(nvs_handle, NVS_REFRESH_POLICY_KEY, stored, sizeof(refresh_policy_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save refresh policy: %s", esp_err_to_name(err));
+    }
+
+    nvs_close(nvs_handle);
+    return err;
+}
+
+// Non-negative number field of json, false if it is missing
+static bool get_json_number(const cJSON *json, const char *name, double *value) {
+    const cJSON *item = cJSON_GetObjectItem(json, name);
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0) {
+        return false;
+    }
+    *value = item->valuedouble;
+    return true;
+}
+
+esp_err_t refresh_policy_set_json(const cJSON *json) {
+    load_policy();
+    refresh_policy_t updated = policy;
+    double value;
+
+    if (get_json_number(json, "maxPartialUpdates", &value)) {
+        updated.max_partial_updates = value;
+    }
+    if (get_json_number(json, "maxChangedPermille", &value)) {
+        updated.max_changed_permille = value > 1000 ? 1000 : value;
+    }
+    // may be below zero
+    const cJSON *min_temperature = cJSON_GetObjectItem(json, "minTemperature");
+    if (cJSON_IsNumber(min_temperature)) {
+        updated.min_temperature = min_temperature->valueint;
+    }
+    if (get_json_number(json, "maxAgeSeconds", &value)) {
+        updated.max_age_s = value;
+    }
+
+    if (memcmp(&updated, &policy, sizeof(refresh_policy_t)) == 0) {
+        return ESP_OK;
+    }
+    policy = updated;
+    ESP_LOGI(TAG, "At most %" PRIu32 " partial updates of %" PRIu32 " permille, from %" PRId32 " C, for %" PRIu32 " s",
+             policy.max_partial_updates, policy.max_changed_permille, policy.min_temperature, policy.max_age_s);
+    return set_policy_nvs(&policy);
+}
+
+// Why the ghosting of the panel calls for a full update, NULL if a partial one is fine.
+// The temperature is only checked if it is known.
+static const char *full_update_reason(const int *temperature) {
+    const panel_state_t *panel = panel_state_get();
+    if (!panel->known) {
+        return "panel content unknown";
+    }
+    if (panel->partial_updates >= policy.max_partial_updates) {
+        return "too many partial updates";
+    }
+    if (temperature != NULL && *temperature < policy.min_temperature) {
+        return "panel too cold";
+    }
+    // the system time starts over after a power loss
+    int64_t age = (int64_t)time(NULL) - panel->last_full_clear;
+    if (policy.max_age_s > 0 && (age < 0 || age > policy.max_age_s)) {
+        return "last full clear too long ago";
+    }
+    return NULL;
+}
+
+// Changed pixels between the front and back framebuffer in per mille
+static uint32_t changed_permille(const EpdiyHighlevelState *state) {
+    const uint32_t *front = (const uint32_t *)state->front_fb;
+    const uint32_t *back = (const uint32_t *)state->back_fb;
+    uint32_t changed = 0;
+
+    for (int i = 0; i < FRAMEBUFFER_SIZE / 4; i++) {
+        // fold each changed nibble into its lowest bit
+        uint32_t diff = front[i] ^ back[i];
+        diff |= diff >> 2;
+        diff |= diff >> 1;
+        changed += __builtin_popcount(diff & 0x11111111);
+    }
+    return (uint64_t)changed * 1000 / PIXELS;
+}
+
+bool refresh_policy_prepare(EpdiyHighlevelState *state) {
+    load_policy();
+    // not worth reading the displayed image from the SD card
+    if (full_update_reason(NULL) != NULL) {
+        return false;
+    }
+    return panel_state_restore(state);
+}
+
+enum EpdDrawError refresh_policy_update(EpdiyHighlevelState *state, int temperature, const char *filename, uint32_t image_hash) {
+    load_policy();
+
+    const char *reason = full_update_reason(&temperature);
+    if (reason == NULL && !state->back_fb_valid) {
+        reason = "displayed image not loaded";
+    }
+    // without transitions, changed pixels would be driven from white
+    if (reason == NULL && !mode_has_transitions(MODE_GL16, waveform_temp_range(temperature))) {
+        reason = "no GL16 transition table";
+    }
+    uint32_t changed = 0;
+    if (reason == NULL) {
+        changed = changed_permille(state);
+        if (changed > policy.max_changed_permille) {
+            reason = "too many changed pixels";
+        }
+    }
+
+    enum EpdDrawError err;
+    bool full = reason != NULL;
+    uint8_t *framebuffer = epd_hl_get_framebuffer(state);
+    if (!full) {
+        ESP_LOGI(TAG, "Partial update, %" PRIu32 " permille changed", changed);
+        err = epd_hl_update_screen(state, MODE_GL16, temperature);
+    } else {
+        ESP_LOGI(TAG, "Full update, %s", reason);
+
+        // frames that don't drive any shade of the image are skipped
+        epd_set_shade_mask(epd_shade_mask(framebuffer, 1600, 1200));
+
+        // the clear runs in the same drive sequence as the image
+        err = epd_hl_update_screen(state, MODE_GC16 | MODE_CLEAR_FIRST, temperature);
+    }
+
+    if (err != EPD_DRAW_SUCCESS) {
+        panel_state_unknown();
+    } else {
+        panel_state_displayed(filename, image_hash, full);
+    }
+    return err;
+}
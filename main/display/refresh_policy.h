@@ -0,0 +1,36 @@
+#ifndef REFRESH_POLICY_H
+#define REFRESH_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "cJSON.h"
+#include "../../components/epdiy/src/epd_highlevel.h"
+
+#define NVS_REFRESH_POLICY_KEY "refresh_policy"
+
+// Limits of partial (non-flashing) updates. Beyond them, a full GC16 with clear removes the ghosting.
+typedef struct {
+    // partial updates since the last full clear
+    uint32_t max_partial_updates;
+    // changed pixels of an update in per mille, larger changes are redrawn fully
+    uint32_t max_changed_permille;
+    // below this panel temperature in °C, partial updates ghost too much
+    int32_t min_temperature;
+    // seconds since the last full clear, 0 for no limit
+    uint32_t max_age_s;
+} refresh_policy_t;
+
+// Take over the fields of a "refreshPolicy" object from the server and store them.
+// Missing fields keep their value.
+esp_err_t refresh_policy_set_json(const cJSON *json);
+
+// Reload the displayed image into the back framebuffer if the next update may be partial.
+// Must be called before the new image is written to the front framebuffer.
+bool refresh_policy_prepare(EpdiyHighlevelState *state);
+
+// Update the panel to the front framebuffer: partially if the policy allows it, fully with a clear otherwise.
+// filename is NULL if the image can't be reloaded from the SD card, see panel_state_displayed().
+enum EpdDrawError refresh_policy_update(EpdiyHighlevelState *state, int temperature, const char *filename, uint32_t image_hash);
+
+#endif // REFRESH_POLICY_H
@@ -4,6 +4,8 @@
 #include "wifi.h"
 #include "config.h"
 #include "image_data.h"
+#include "panel_state.h"
+#include "refresh_policy.h"
 #include "esp_log.h" 
 #include <string.h>
 
@@ -92,7 +94,10 @@ void draw_white_rectangle(uint8_t* framebuffer, int x, int y, int width, int hei
 void render_text(void){
     board_poweron(&ctrl_state);
    // clear();
-    enum EpdDrawError _err = epd_hl_update_screen(&hl_state, MODE_GC16, 25);
+    // usually only the pixels of the overlay change, the image around it is not driven.
+    // The overlay can't be reloaded from the SD card, only its hash is kept.
+    uint32_t image_hash = panel_image_hash(epd_hl_get_framebuffer(&hl_state));
+    enum EpdDrawError _err = refresh_policy_update(&hl_state, panel_temperature, NULL, image_hash);
     if (_err != EPD_DRAW_SUCCESS) {
         ESP_LOGE("render_text", "Failed to update screen: %d", _err);
     }
@@ -102,6 +107,8 @@ void render_text(void){
 void display_text(char* text) {
     disable_wifi();
     renderer_init();
+    // after deep sleep, draw over the image the panel still shows
+    panel_state_restore(&hl_state);
     
     // Calculate total width based on individual letter widths
     int text_width = 0;
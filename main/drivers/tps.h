@@ -38,6 +38,7 @@ esp_err_t tps_setup(TPS_t *tps);
 esp_err_t tps_write(TPS_t *tps, uint8_t reg, uint8_t data);
 esp_err_t tps_read(TPS_t *tps, uint8_t reg, uint8_t *data, size_t size);
 esp_err_t tps_set_vcom(TPS_t *tps, unsigned vcom);
+esp_err_t tps_read_thermistor(TPS_t *tps, int8_t *temperature);
 void tps_powerup();
 void tps_powerdown();
 void tps_wakeup();
@@ -21,6 +21,7 @@
 #include "sd_card.h"
 #include "measure.h"
 #include "text.h"
+#include "lcd_tune.h"
 
 #define WAKE_UP_PERIOD_US (10 * 60 * 1000000)  // 60 seconds in microseconds
 
@@ -58,6 +59,8 @@ void setup(){
     get_queue_nvs();
     get_waveform();
     renderer_init();
+    // once per unit, measure how fast the display can be driven
+    lcd_tune_run(false);
 
     //ota_init();
     //check_ota_updates();
@@ -11,6 +11,8 @@
 #include "config.h"
 #include "measure.h"
 #include "image_queue.h"
+#include "lcd_tune.h"
+#include "refresh_policy.h"
 #include "../../components/epdiy/src/output_common/lut.h"
 
 static const char *TAG = "API";
@@ -18,8 +20,15 @@ static const char *TAG = "API";
 static char json_response_buffer[JSON_RESPONSE_BUFFER_SIZE];
 static int json_buffer_index = 0;
 
-static uint8_t waveform_buffer[WAVEFORM_SIZE];
+// waveform, optionally followed by the line time of each frame (16 bit little endian, us)
+// and then by the ops of the clear sequence
+#define WAVEFORM_WITH_TIMES_SIZE (WAVEFORM_SIZE + FRAMES * 2)
+#define WAVEFORM_WITH_CLEAR_SIZE (WAVEFORM_WITH_TIMES_SIZE + CLEAR_FRAMES)
+
+static uint8_t waveform_buffer[WAVEFORM_WITH_CLEAR_SIZE];
 static size_t waveform_buffer_index = 0;
+// temperature range of the waveform being downloaded
+static int waveform_buffer_range = WAVEFORM_DEFAULT_RANGE;
 
 // Waveform HTTP handler
 static esp_err_t waveform_http_event_handler(esp_http_client_event_t *evt) {
@@ -28,7 +37,11 @@ static esp_err_t waveform_http_event_handler(esp_http_client_event_t *evt) {
             ESP_LOGE(TAG, "HTTP_EVENT_ERROR");
             break;
         case HTTP_EVENT_ON_DATA:
-            if (evt->data_len + waveform_buffer_index <= WAVEFORM_SIZE) {
+            // error pages are not waveforms, get_range_waveform() reports the status
+            if (esp_http_client_get_status_code(evt->client) != 200) {
+                break;
+            }
+            if (evt->data_len + waveform_buffer_index <= WAVEFORM_WITH_CLEAR_SIZE) {
                 memcpy(waveform_buffer + waveform_buffer_index, evt->data, evt->data_len);
                 waveform_buffer_index += evt->data_len;
             } else {
@@ -37,15 +50,30 @@ static esp_err_t waveform_http_event_handler(esp_http_client_event_t *evt) {
             }
             break;
         case HTTP_EVENT_ON_FINISH:
-            if (waveform_buffer_index == WAVEFORM_SIZE) {
+            if (esp_http_client_get_status_code(evt->client) != 200) {
+                break;
+            }
+            if (waveform_buffer_index == WAVEFORM_SIZE || waveform_buffer_index == WAVEFORM_WITH_TIMES_SIZE
+                    || waveform_buffer_index == WAVEFORM_WITH_CLEAR_SIZE) {
                 size_t index = 0;
                 for (int i = 0; i < SHADES; i++) {
                     for (int j = 0; j < FRAMES; j++) {
                         custom_wave[i][j] = waveform_buffer[index++];
                     }
                 }
-                save_waveform();
-                ESP_LOGI(TAG, "Waveform data successfully received and loaded");
+                for (int j = 0; j < FRAMES; j++) {
+                    frame_times[j] = 0;
+                    if (waveform_buffer_index >= WAVEFORM_WITH_TIMES_SIZE) {
+                        frame_times[j] = waveform_buffer[index] | (waveform_buffer[index + 1] << 8);
+                        index += 2;
+                    }
+                }
+                if (waveform_buffer_index == WAVEFORM_WITH_CLEAR_SIZE && !set_clear_wave(&waveform_buffer[index])) {
+                    ESP_LOGE(TAG, "Invalid clear sequence received, keeping the current one");
+                }
+                analyze_waveform();
+                save_waveform(waveform_buffer_range);
+                ESP_LOGI(TAG, "Waveform data of range %d successfully received and loaded", waveform_buffer_range);
             } else {
                 ESP_LOGE(TAG, "Incorrect waveform size received: %d bytes", waveform_buffer_index);
                 return ESP_FAIL;
@@ -60,11 +88,82 @@ static esp_err_t waveform_http_event_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
-esp_err_t get_waveform(void) {
-    ESP_LOGI(TAG, "Getting waveform");
+// waveform container with the tables of further modes, see store_waveform_container()
+static uint8_t *container_buffer = NULL;
+static size_t container_buffer_index = 0;
+
+static esp_err_t container_http_event_handler(esp_http_client_event_t *evt) {
+    switch(evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGE(TAG, "HTTP_EVENT_ERROR");
+            break;
+        case HTTP_EVENT_ON_DATA:
+            if (esp_http_client_get_status_code(evt->client) != 200) {
+                break;
+            }
+            if (evt->data_len + container_buffer_index <= WAVEFORM_CONTAINER_MAX_SIZE) {
+                memcpy(container_buffer + container_buffer_index, evt->data, evt->data_len);
+                container_buffer_index += evt->data_len;
+            } else {
+                ESP_LOGE(TAG, "Waveform container buffer overflow");
+                return ESP_FAIL;
+            }
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            if (container_buffer_index > 0 && store_waveform_container(container_buffer, container_buffer_index)) {
+                ESP_LOGI(TAG, "Waveform container successfully received");
+            }
+            container_buffer_index = 0;
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            container_buffer_index = 0;
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t get_waveform_container(void) {
+    char url[256];
+    snprintf(url, sizeof(url), "%s/get-waveforms", BASE_URL);
+
+    container_buffer = malloc(WAVEFORM_CONTAINER_MAX_SIZE);
+    if (container_buffer == NULL) {
+        ESP_LOGE(TAG, "No memory for the waveform container");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .method = HTTP_METHOD_GET,
+        .event_handler = container_http_event_handler,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+
+    container_buffer_index = 0;
+
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to make GET request: %s", esp_err_to_name(err));
+    }
 
+    esp_http_client_cleanup(client);
+    free(container_buffer);
+    container_buffer = NULL;
+    return err;
+}
+
+static esp_err_t get_range_waveform(int range) {
     char url[256];
-    snprintf(url, sizeof(url), "%s/get-waveform", BASE_URL);
+    if (range == WAVEFORM_DEFAULT_RANGE) {
+        snprintf(url, sizeof(url), "%s/get-waveform", BASE_URL);
+    } else {
+        // ranges reach up to the lowest temperature of the next one
+        int max_temp = range + 1 < WAVEFORM_TEMP_RANGES ? waveform_temp_min[range + 1] : 127;
+        snprintf(url, sizeof(url), "%s/get-waveform?range=%d&minTemp=%d&maxTemp=%d",
+                 BASE_URL, range, waveform_temp_min[range], max_temp);
+    }
 
     esp_http_client_config_t config = {
         .url = url,
@@ -74,16 +173,41 @@ esp_err_t get_waveform(void) {
     esp_http_client_handle_t client = esp_http_client_init(&config);
 
     waveform_buffer_index = 0;
+    waveform_buffer_range = range;
 
     esp_err_t err = esp_http_client_perform(client);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to make GET request: %s", esp_err_to_name(err));
+    } else if (esp_http_client_get_status_code(client) != 200) {
+        // not an error, the range then uses the default waveform
+        int status = esp_http_client_get_status_code(client);
+        if (range == WAVEFORM_DEFAULT_RANGE) {
+            ESP_LOGW(TAG, "No default waveform (HTTP %d), keeping the current one", status);
+        } else {
+            ESP_LOGI(TAG, "Range %d has no waveform of its own (HTTP %d)", range, status);
+            forget_waveform(range);
+        }
     }
 
     esp_http_client_cleanup(client);
     return err;
 }
 
+esp_err_t get_waveform(void) {
+    ESP_LOGI(TAG, "Getting waveform");
+
+    // the default waveform, then the ones of the temperature ranges that have their own
+    esp_err_t err = get_range_waveform(WAVEFORM_DEFAULT_RANGE);
+    for (int range = 0; range < WAVEFORM_TEMP_RANGES && err == ESP_OK; range++) {
+        err = get_range_waveform(range);
+    }
+    // tables of further modes, e.g. MODE_DU for status text
+    if (err == ESP_OK) {
+        err = get_waveform_container();
+    }
+    return err;
+}
+
 // JSON HTTP handler for check_updates
 static esp_err_t json_http_event_handler(esp_http_client_event_t *evt) {
     switch(evt->event_id) {
@@ -158,6 +282,9 @@ esp_err_t check_updates(void) {
     return err;
 }
 
+// Set by the sync response, output tuning takes too long for the event handler
+static bool calibrate_requested = false;
+
 // Sync handler
 static esp_err_t sync_handler(esp_http_client_event_t *evt) {
     switch(evt->event_id) {
@@ -177,6 +304,12 @@ static esp_err_t sync_handler(esp_http_client_event_t *evt) {
                 return ESP_FAIL;
             }
 
+            // before the queue, so an update of this sync already follows it
+            cJSON *refresh_policy = cJSON_GetObjectItem(json, "refreshPolicy");
+            if (cJSON_IsObject(refresh_policy)) {
+                refresh_policy_set_json(refresh_policy);
+            }
+
             cJSON *queue = cJSON_GetObjectItem(json, "queue");
             if (queue && cJSON_IsArray(queue)) {
                 int array_size = cJSON_GetArraySize(queue);
@@ -197,6 +330,10 @@ static esp_err_t sync_handler(esp_http_client_event_t *evt) {
                 }
                 compare_queues();
             }
+
+            // run by server_sync() once the connection is closed
+            cJSON *calibrate = cJSON_GetObjectItem(json, "calibrate");
+            calibrate_requested = cJSON_IsTrue(calibrate);
             cJSON_Delete(json);
             break;
         case HTTP_EVENT_ERROR:
@@ -208,6 +345,37 @@ static esp_err_t sync_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
+// Render path measurements of the last draw, for spotting refreshes
+// that ran out of time on the output.
+static void add_render_stats(cJSON *root) {
+    const EpdRenderStats *stats = epd_render_stats();
+    if (stats->draw_time_us == 0) {
+        return;
+    }
+
+    uint32_t spins = 0;
+    uint32_t timeouts = 0;
+    cJSON *lines = cJSON_CreateArray();
+    for (int i = 0; i < EPD_STATS_THREADS; i++) {
+        spins += stats->slot_wait_spins[i] + stats->fetch_wait_spins[i];
+        timeouts += stats->slot_timeouts[i];
+        cJSON_AddItemToArray(lines, cJSON_CreateNumber(stats->lines_rendered[i]));
+    }
+
+    cJSON *render = cJSON_AddObjectToObject(root, "render");
+    cJSON_AddNumberToObject(render, "drawMs", stats->draw_time_us / 1000);
+    cJSON_AddNumberToObject(render, "clearMs", stats->clear_time_us / 1000);
+    cJSON_AddNumberToObject(render, "frames", stats->frames);
+    cJSON_AddNumberToObject(render, "missed", stats->missed_lines);
+    cJSON_AddNumberToObject(render, "redrives", stats->redrives);
+    cJSON_AddNumberToObject(render, "minAhead", stats->min_lines_ahead);
+    cJSON_AddNumberToObject(render, "eofMaxCycles", stats->eof_max_cycles);
+    cJSON_AddNumberToObject(render, "stolen", epd_chunks_stolen());
+    cJSON_AddNumberToObject(render, "spins", spins);
+    cJSON_AddNumberToObject(render, "slotTimeouts", timeouts);
+    cJSON_AddItemToObject(render, "lines", lines);
+}
+
 esp_err_t server_sync(void) {
     ESP_LOGI(TAG, "Syncing...");
 
@@ -218,6 +386,7 @@ esp_err_t server_sync(void) {
     cJSON_AddNumberToObject(root, "batVol", get_bat_vol());
     cJSON_AddNumberToObject(root, "solVol", get_solar_vol());
     cJSON_AddStringToObject(root, "CurImg", "NULL");
+    add_render_stats(root);
 
     char *post_data = cJSON_Print(root);
 
@@ -235,6 +404,7 @@ esp_err_t server_sync(void) {
     esp_http_client_set_post_field(client, post_data, strlen(post_data));
 
     json_buffer_index = 0;
+    calibrate_requested = false;
     esp_err_t err = esp_http_client_perform(client);
 
     if (err != ESP_OK) {
@@ -244,6 +414,11 @@ esp_err_t server_sync(void) {
     cJSON_Delete(root);
     free(post_data);
     esp_http_client_cleanup(client);
+
+    if (calibrate_requested) {
+        calibrate_requested = false;
+        lcd_tune_run(true);
+    }
     return err;
 }
 
@@ -180,6 +180,18 @@ void setup_wifi() {
 }
 
 
+// Let the radio sleep between beacons while the display output falls behind,
+// without dropping the connection.
+void wifi_throttle(bool throttle) {
+    static wifi_ps_type_t saved_ps = WIFI_PS_NONE;
+    if (throttle) {
+        esp_wifi_get_ps(&saved_ps);
+        esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+    } else {
+        esp_wifi_set_ps(saved_ps);
+    }
+}
+
 void disable_wifi() {
     esp_wifi_stop();
     esp_wifi_deinit();
@@ -19,5 +19,6 @@ void nvs_init(void);
 void setup_wifi(void);
 void disable_wifi(void);
 void enable_wifi(void);
+void wifi_throttle(bool throttle);
 
 #endif // WIFI_H
@@ -0,0 +1,359 @@
+// Runs updates through the line ring of the LCD output (output_lcd/lcd_driver.c,
+// output_lcd/render_lcd.c) with a simulated LCD peripheral and DMA.
+// One render thread is stalled past the end of a frame: the update must still
+// finish, drive the missed rows again and leave no line of the ring behind.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <driver/gpio.h>
+#include <esp_intr_alloc.h>
+#include <esp_rom_sys.h>
+#include <esp_private/gdma.h>
+#include <hal/lcd_ll.h>
+#include <hal/rmt_ll.h>
+#include <soc/lcd_periph.h>
+#include <soc/rmt_periph.h>
+
+#include "epdiy.h"
+#include "lut.h"
+#include "render_context.h"
+#include "output_lcd/lcd_driver.h"
+#include "output_lcd/render_lcd.h"
+
+#define DISPLAY_WIDTH 1600
+#define DISPLAY_HEIGHT 1200
+#define LINE_BYTES (DISPLAY_WIDTH / 4)
+#define ROW_BYTES (DISPLAY_WIDTH / 2)
+#define PIXEL_CLOCK_MHZ 10
+
+/// frames of the built-in waveform driven per update
+#define TEST_FRAMES 6
+/// output time of a simulated line
+#define SIM_LINE_US 20
+/// The stalled render thread holds the rest of the chunk starting at this row.
+#define STALL_ROW 304
+/// long enough for the output to pass the end of the frame
+#define STALL_US 100000
+
+static RenderContext_t ctx;
+static uint8_t *framebuffer;
+/// `custom_lut_func()` output per frame and row
+static uint8_t *expected;
+/// times each row was output with its data, per frame
+static int driven[TEST_FRAMES][DISPLAY_HEIGHT];
+static int wrong_lines = 0;
+static int failures = 0;
+
+/// arguments of the `underrun_cb` calls, in order
+static bool underrun_calls[4];
+static int underrun_count = 0;
+
+/// the render thread that renders this row next stalls, -1 for none
+static atomic_int stall_row = -1;
+
+// Peripherals only configured by the driver.
+rmt_dev_t RMT;
+rmt_mem_t RMTMEM;
+const uint32_t GPIO_PIN_MUX_REG[GPIO_NUM_MAX];
+const lcd_signal_conn_t lcd_periph_signals;
+const rmt_signal_conn_t rmt_periph_signals;
+
+/// LCD peripheral and DMA: lines are output along the descriptor chain,
+/// batch by batch as programmed by the driver.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    int active_lines;
+    uint32_t status;
+    dma_descriptor_t *node;
+    // display row and frame of the next output line
+    int row;
+    int frame;
+} sim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+static intr_handler_t vsync_isr = NULL;
+static gdma_event_callback_t eof_callback = NULL;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAILED: %s\n", message);
+        failures++;
+    }
+}
+
+esp_err_t esp_intr_alloc_intrstatus(int source, int flags, uint32_t reg, uint32_t mask,
+                                    intr_handler_t handler, void *arg, intr_handle_t *handle) {
+    vsync_isr = handler;
+    return ESP_OK;
+}
+
+esp_err_t gdma_register_tx_event_callbacks(gdma_channel_handle_t chan, gdma_tx_event_callbacks_t *cbs, void *user_data) {
+    eof_callback = cbs->on_trans_eof;
+    return ESP_OK;
+}
+
+esp_err_t gdma_start(gdma_channel_handle_t chan, intptr_t desc_base_addr) {
+    pthread_mutex_lock(&sim.lock);
+    sim.node = (dma_descriptor_t *)desc_base_addr;
+    sim.row = ctx.lines_first;
+    sim.frame = ctx.current_frame;
+    pthread_mutex_unlock(&sim.lock);
+    return ESP_OK;
+}
+
+void lcd_ll_start(lcd_cam_dev_t *dev) {
+    pthread_mutex_lock(&sim.lock);
+    sim.running = true;
+    pthread_cond_signal(&sim.cond);
+    pthread_mutex_unlock(&sim.lock);
+}
+
+void lcd_ll_stop(lcd_cam_dev_t *dev) {
+    pthread_mutex_lock(&sim.lock);
+    sim.running = false;
+    pthread_mutex_unlock(&sim.lock);
+}
+
+void lcd_ll_set_vertical_timing(lcd_cam_dev_t *dev, uint32_t vsw, uint32_t vbp, uint32_t active_height, uint32_t vfp) {
+    sim.active_lines = active_height;
+}
+
+void lcd_ll_enable_auto_next_frame(lcd_cam_dev_t *dev, bool enable) {
+}
+
+uint32_t lcd_ll_get_interrupt_status(lcd_cam_dev_t *dev) {
+    return sim.status;
+}
+
+void lcd_ll_clear_interrupt_status(lcd_cam_dev_t *dev, uint32_t mask) {
+    sim.status &= ~mask;
+}
+
+void set_mode(bool state) {
+}
+
+static const uint8_t *expected_line(int frame, int row) {
+    return &expected[((size_t)frame * DISPLAY_HEIGHT + row) * LINE_BYTES];
+}
+
+/// Lines of no-ops are not counted, they are output for rows that are not driven.
+static void record_line(const uint8_t *data, int frame, int row) {
+    static const uint8_t no_ops[LINE_BYTES];
+    if (memcmp(data, no_ops, LINE_BYTES) == 0) {
+        return;
+    }
+    if (row < DISPLAY_HEIGHT && memcmp(data, expected_line(frame, row), LINE_BYTES) == 0) {
+        driven[frame][row]++;
+        return;
+    }
+    if (wrong_lines < 10) {
+        printf("row %d of frame %d was output with the data of another line\n", row, frame);
+    }
+    wrong_lines++;
+}
+
+static void *lcd_simulation(void *arg) {
+    while (true) {
+        pthread_mutex_lock(&sim.lock);
+        while (!sim.running) {
+            pthread_cond_wait(&sim.cond, &sim.lock);
+        }
+        // the driver starts each batch on its own
+        sim.running = false;
+        int lines = sim.active_lines;
+        pthread_mutex_unlock(&sim.lock);
+
+        int unpaced = 0;
+        for (int l = 0; l < lines; l++) {
+            // two descriptors per line, the dummy bytes and the line data
+            dma_descriptor_t *data = sim.node->next;
+            record_line(data->buffer, sim.frame, sim.row++);
+            sim.node = data->next;
+            unpaced++;
+            if (data->dw0.suc_eof) {
+                // sleeping per line would be too coarse
+                esp_rom_delay_us(SIM_LINE_US * unpaced);
+                unpaced = 0;
+                gdma_event_data_t event = {.tx_eof_desc_addr = (intptr_t)data};
+                eof_callback(NULL, &event, NULL);
+            }
+        }
+
+        sim.status |= LCD_LL_EVENT_VSYNC_END;
+        vsync_isr(NULL);
+    }
+    return NULL;
+}
+
+void __real_epd_lcd_line_ready(int line);
+
+/// Hold the render thread that finished `stall_row` until its frame is over.
+void __wrap_epd_lcd_line_ready(int line) {
+    int row = line;
+    if (atomic_compare_exchange_strong(&stall_row, &row, -1)) {
+        usleep(STALL_US);
+    }
+    __real_epd_lcd_line_ready(line);
+}
+
+static void render_thread(void *arg) {
+    int thread_id = (intptr_t)arg;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        lcd_calculate_frame(&ctx, thread_id);
+        xSemaphoreGive(ctx.feed_done_smphr[thread_id]);
+    }
+}
+
+static void record_underrun(bool relieve) {
+    if (underrun_count < 4) {
+        underrun_calls[underrun_count] = relieve;
+    }
+    underrun_count++;
+}
+
+/// Set up the render context and threads as `epd_renderer_init()` does, with direct lookup.
+static void init_renderer() {
+    LcdEpdConfig_t config = {
+        .pixel_clock = PIXEL_CLOCK_MHZ * 1000 * 1000,
+        .ckv_high_time = 70,
+        .line_front_porch = 4,
+        .le_high_time = 4,
+        .bus_width = 8,
+        .bus = {
+            .data_0 = GPIO_NUM_0, .data_1 = GPIO_NUM_1, .data_2 = GPIO_NUM_2, .data_3 = GPIO_NUM_3,
+            .data_4 = GPIO_NUM_4, .data_5 = GPIO_NUM_5, .data_6 = GPIO_NUM_6, .data_7 = GPIO_NUM_7,
+            .clock = GPIO_NUM_8,
+            .ckv = GPIO_NUM_9,
+            .start_pulse = GPIO_NUM_10,
+            .leh = GPIO_NUM_11,
+            .stv = GPIO_NUM_12,
+            .oe = GPIO_NUM_NC,
+        },
+        .ring_prefill = 64,
+    };
+    epd_lcd_init(&config, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+
+    ctx.display_width = DISPLAY_WIDTH;
+    ctx.display_height = DISPLAY_HEIGHT;
+    ctx.shade_mask = ALL_SHADES;
+    ctx.conversion_lut_size = 0;
+    ctx.frame_done = xSemaphoreCreateBinary();
+    ctx.redrive_buffer = malloc(DISPLAY_HEIGHT);
+    ctx.row_waveform = calloc(DISPLAY_HEIGHT, 1);
+    ctx.underrun_cb = record_underrun;
+    for (int i = 0; i < NUM_RENDER_THREADS; i++) {
+        ctx.feed_done_smphr[i] = xSemaphoreCreateBinary();
+        ctx.feed_line_buffers[i] = malloc(PREFETCH_ROWS * DISPLAY_WIDTH / 2);
+        xTaskCreatePinnedToCore(render_thread, "epd_prep", 1 << 11, (void *)(intptr_t)i,
+                                1, &ctx.feed_tasks[i], i);
+    }
+}
+
+/// Draw the framebuffer as `epd_draw_base()` does, then check every row
+/// of every active frame was output exactly once with its data.
+static void draw(const char *name) {
+    EpdRect area = {.x = 0, .y = 0, .width = DISPLAY_WIDTH, .height = DISPLAY_HEIGHT};
+    ctx.area = area;
+    ctx.crop_to = area;
+    ctx.mode = MODE_GC16 | MODE_PACKING_2PPB;
+    ctx.error = EPD_DRAW_SUCCESS;
+    ctx.drawn_lines = NULL;
+    ctx.data_ptr = framebuffer;
+    ctx.lut_func = get_lut_function(&ctx);
+    ctx.lines_prepared = 0;
+    ctx.lines_first = 0;
+    ctx.lines_total = DISPLAY_HEIGHT;
+    memset(&ctx.stats, 0, sizeof(ctx.stats));
+    ctx.stats.min_lines_ahead = -1;
+    ctx.current_frame = 0;
+    ctx.cycle_frames = TEST_FRAMES;
+    ctx.frame_mask = waveform_frame_mask(ALL_SHADES);
+    ctx.phase_times = NULL;
+    memset(driven, 0, sizeof(driven));
+
+    lcd_do_update(&ctx);
+
+    static const uint8_t no_ops[LINE_BYTES];
+    int bad_rows = 0;
+    for (int frame = 0; frame < TEST_FRAMES; frame++) {
+        bool active = ctx.frame_mask & (1 << frame);
+        for (int row = 0; row < DISPLAY_HEIGHT; row++) {
+            bool driven_row = active && memcmp(expected_line(frame, row), no_ops, LINE_BYTES) != 0;
+            if (driven[frame][row] != driven_row) {
+                if (bad_rows < 10) {
+                    printf("%s: row %d of frame %d was output %d times\n", name, row, frame, driven[frame][row]);
+                }
+                bad_rows++;
+            }
+        }
+    }
+    check(bad_rows == 0, "every row is output once per frame");
+    check(wrong_lines == 0, "no line is output with stale data");
+    check(!(ctx.error & EPD_DRAW_EMPTY_LINE_QUEUE), "the missed lines are driven again");
+    check(ctx.error == EPD_DRAW_SUCCESS, "the update succeeds");
+    for (int i = 0; i < NUM_RENDER_THREADS; i++) {
+        check(ctx.stats.slot_timeouts[i] == 0, "no render thread times out waiting for a slot");
+    }
+    check(epd_lcd_pixel_clock_MHz() == PIXEL_CLOCK_MHZ, "the pixel clock is restored after the update");
+}
+
+int main() {
+    analyze_waveform();
+
+    framebuffer = malloc(ROW_BYTES * DISPLAY_HEIGHT);
+    uint32_t rng_state = 0x12345678;
+    for (int i = 0; i < ROW_BYTES * DISPLAY_HEIGHT; i++) {
+        // xorshift32
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        framebuffer[i] = rng_state;
+    }
+    expected = malloc((size_t)TEST_FRAMES * DISPLAY_HEIGHT * LINE_BYTES);
+    for (int frame = 0; frame < TEST_FRAMES; frame++) {
+        for (int row = 0; row < DISPLAY_HEIGHT; row++) {
+            custom_lut_func((const uint32_t *)&framebuffer[row * ROW_BYTES],
+                            (uint8_t *)expected_line(frame, row), NULL, frame);
+        }
+    }
+
+    pthread_t simulation;
+    pthread_create(&simulation, NULL, lcd_simulation, NULL);
+    init_renderer();
+
+    // a render thread falls behind the output by a whole frame
+    stall_row = STALL_ROW;
+    draw("stalled update");
+    check(stall_row < 0, "the render thread was stalled");
+    check(ctx.stats.missed_lines >= RENDER_CHUNK_LINES - 1, "the lines of the stalled thread are missed");
+    check(ctx.stats.redrives >= 1, "the missed rows are driven again");
+    check(underrun_count == 2 && underrun_calls[0] && !underrun_calls[1],
+          "the underrun callback relieves the render threads during the update");
+    printf("stalled update: %u lines missed, %d redrives\n", ctx.stats.missed_lines, ctx.stats.redrives);
+
+    // the ring is usable for the following update
+    underrun_count = 0;
+    draw("next update");
+
+    // the trigger line must lie beyond the two line groups linked at the start
+    epd_lcd_set_ring_prefill(16);
+    check(epd_lcd_ring_prefill() > 16, "the prefill covers more than the line groups linked at the start");
+    draw("shortest prefill");
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("the output recovered from the stalled render thread\n");
+    return 0;
+}
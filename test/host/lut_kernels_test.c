@@ -0,0 +1,239 @@
+// Checks the output kernels of output_common/lut.c against the reference
+// custom_lut_func(), for all frames of the built-in and random waveforms.
+// There is no stored waveform on the host, so difference images are checked
+// without transition tables: changed pixels are driven as their new shade.
+// Also prints the time each kernel takes per line on the build machine.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lut.h"
+
+// one display line: 1600 pixels, 2 per input byte, 4 per output byte
+#define LINE_PIXELS 1600
+#define INPUT_WORDS (LINE_PIXELS / 8)
+#define OUTPUT_BYTES (LINE_PIXELS / 4)
+
+#define RANDOM_WAVEFORMS 200
+#define LINES_PER_FRAME 4
+#define BENCHMARK_LINES 20000
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t next_random() {
+    // xorshift32
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint8_t lut_64k[LUT_64K_SIZE];
+static uint8_t lut_1k[LUT_1K_SIZE];
+static uint8_t difference_lut[DIFFERENCE_LUT_SIZE];
+
+static uint32_t line[INPUT_WORDS];
+static uint32_t planes[INPUT_WORDS];
+/// `MODE_PACKING_1PPB_DIFFERENCE`: (to, from) shades, one byte per pixel
+static uint32_t difference_line[LINE_PIXELS / 4];
+static uint32_t expected[OUTPUT_BYTES / 4];
+static uint32_t actual[OUTPUT_BYTES / 4];
+
+static int failures = 0;
+
+/// Transpose a 2PPB line into the layout of `MODE_PACKING_4PLANES`:
+/// per 32 pixels one word per bit of the shade, pixels 0-15 in the even, 16-31 in the odd bits.
+static void pack_planes(const uint32_t *src, uint32_t *dst) {
+    for (int block = 0; block < INPUT_WORDS / 4; block++) {
+        uint32_t *out = &dst[block * 4];
+        memset(out, 0, 4 * sizeof(uint32_t));
+        for (int i = 0; i < 32; i++) {
+            int shade = (src[block * 4 + i / 8] >> (4 * (i % 8))) & 0x0F;
+            int bit = i < 16 ? 2 * i : 2 * (i - 16) + 1;
+            for (int p = 0; p < 4; p++) {
+                out[p] |= (uint32_t)((shade >> p) & 1) << bit;
+            }
+        }
+    }
+}
+
+/// Use the shades of `line` as new shades, about every fourth pixel keeps its shade.
+static void fill_difference_line() {
+    uint8_t *pixels = (uint8_t *)difference_line;
+    for (int i = 0; i < LINE_PIXELS; i++) {
+        int to = (line[i / 8] >> (4 * (i % 8))) & 0x0F;
+        int from = next_random() % 4 == 0 ? to : next_random() % SHADES;
+        pixels[i] = (to << 4) | from;
+    }
+}
+
+/// Pixels that keep their shade are not driven.
+static void mask_unchanged() {
+    const uint8_t *pixels = (const uint8_t *)difference_line;
+    uint8_t *e = (uint8_t *)expected;
+    for (int i = 0; i < LINE_PIXELS; i++) {
+        if ((pixels[i] >> 4) == (pixels[i] & 0x0F)) {
+            e[i / 4] &= ~(0x03 << (2 * (i % 4)));
+        }
+    }
+}
+
+static void check_output(const char *kernel, const char *waveform, int frame) {
+    if (memcmp(expected, actual, OUTPUT_BYTES) == 0) {
+        return;
+    }
+    const uint8_t *e = (const uint8_t *)expected;
+    const uint8_t *a = (const uint8_t *)actual;
+    int byte = 0;
+    while (e[byte] == a[byte]) {
+        byte++;
+    }
+    if (failures < 20) {
+        printf("%s differs for %s waveform, frame %d: byte %d is 0x%02X instead of 0x%02X\n",
+               kernel, waveform, frame, byte, a[byte], e[byte]);
+    }
+    failures++;
+}
+
+static void fill_line(int variant) {
+    if (variant == 0) {
+        // every shade next to every other shade
+        for (int w = 0; w < INPUT_WORDS; w++) {
+            uint32_t word = 0;
+            for (int p = 0; p < 8; p++) {
+                word |= (uint32_t)((w * 8 + p + w / 16) & 0x0F) << (4 * p);
+            }
+            line[w] = word;
+        }
+        return;
+    }
+    for (int w = 0; w < INPUT_WORDS; w++) {
+        line[w] = next_random();
+    }
+}
+
+/// Compare all kernels with the reference for every frame of `custom_wave`.
+static void check_waveform(const char *waveform) {
+    analyze_waveform();
+
+    for (int frame = 0; frame < FRAMES; frame++) {
+        uint16_t terms[2];
+        calculate_plane_terms(terms, frame);
+        calculate_lut_1k(lut_1k, frame);
+        // in two parts, as the render threads prepare it
+        calculate_lut_part(lut_64k, frame, 0, 2);
+        calculate_lut_part(lut_64k, frame, 1, 2);
+        calculate_difference_lut(difference_lut, frame);
+
+        for (int variant = 0; variant < LINES_PER_FRAME; variant++) {
+            fill_line(variant);
+            custom_lut_func(line, (uint8_t *)expected, NULL, frame);
+
+            lut_64k_func(line, (uint8_t *)actual, lut_64k, frame);
+            check_output("lut_64k_func", waveform, frame);
+
+            lut_1k_func(line, (uint8_t *)actual, lut_1k, frame);
+            check_output("lut_1k_func", waveform, frame);
+
+            pack_planes(line, planes);
+            planes_lut_func(planes, (uint8_t *)actual, (const uint8_t *)terms, frame);
+            check_output("planes_lut_func", waveform, frame);
+
+            // the kernel analyze_waveform() chose for the frame
+            switch (frame_info[frame].kind) {
+                case FRAME_UNIFORM:
+                    memset(actual, 0xFF, OUTPUT_BYTES);
+                    uniform_line_func(line, (uint8_t *)actual, NULL, frame);
+                    check_output("uniform_line_func", waveform, frame);
+                    break;
+                case FRAME_BINARY:
+                    threshold_line_func(line, (uint8_t *)actual, NULL, frame);
+                    check_output("threshold_line_func", waveform, frame);
+                    break;
+                case FRAME_GENERAL:
+                    break;
+            }
+
+            fill_difference_line();
+            mask_unchanged();
+            difference_lut_func(difference_line, (uint8_t *)actual, difference_lut, frame);
+            check_output("difference_lut_func", waveform, frame);
+        }
+    }
+}
+
+/// Random ops, with uniform and threshold frames mixed in so every kernel is exercised.
+static void random_waveform() {
+    for (int frame = 0; frame < FRAMES; frame++) {
+        uint32_t kind = next_random() % 3;
+        int threshold = 1 + next_random() % (SHADES - 1);
+        uint8_t low = next_random() % 3;
+        uint8_t high = next_random() % 3;
+        for (int s = 0; s < SHADES; s++) {
+            if (kind == FRAME_UNIFORM) {
+                custom_wave[s][frame] = low;
+            } else if (kind == FRAME_BINARY) {
+                custom_wave[s][frame] = s < threshold ? low : high;
+            } else {
+                custom_wave[s][frame] = next_random() % 3;
+            }
+        }
+    }
+}
+
+static void benchmark_kernel(const char *kernel, lut_func_t func, const uint32_t *input, const uint8_t *lut, int frame) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCHMARK_LINES; i++) {
+        func(input, (uint8_t *)actual, lut, frame);
+        // keep the calls from being merged
+        __asm__ volatile("" : : "r"(actual) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("  %-20s %6.0f ns\n", kernel, ns / BENCHMARK_LINES);
+}
+
+/// Time per line of the kernels for a frame with all shades driven differently.
+static void benchmark() {
+    random_waveform();
+    int frame = 0;
+    for (int s = 0; s < SHADES; s++) {
+        custom_wave[s][frame] = s % 3;
+    }
+    analyze_waveform();
+    fill_line(1);
+    pack_planes(line, planes);
+    fill_difference_line();
+
+    uint16_t terms[2];
+    calculate_plane_terms(terms, frame);
+    calculate_lut_1k(lut_1k, frame);
+    calculate_lut_part(lut_64k, frame, 0, 1);
+    calculate_difference_lut(difference_lut, frame);
+
+    printf("time per %d pixel line on the build machine:\n", LINE_PIXELS);
+    benchmark_kernel("custom_lut_func", custom_lut_func, line, NULL, frame);
+    benchmark_kernel("lut_64k_func", lut_64k_func, line, lut_64k, frame);
+    benchmark_kernel("lut_1k_func", lut_1k_func, line, lut_1k, frame);
+    benchmark_kernel("planes_lut_func", planes_lut_func, planes, (const uint8_t *)terms, frame);
+    benchmark_kernel("difference_lut_func", difference_lut_func, difference_line, difference_lut, frame);
+}
+
+int main() {
+    check_waveform("built-in");
+
+    for (int i = 0; i < RANDOM_WAVEFORMS; i++) {
+        random_waveform();
+        check_waveform("random");
+    }
+
+    if (failures > 0) {
+        printf("%d kernel outputs differ from custom_lut_func\n", failures);
+        return 1;
+    }
+    printf("all kernels match custom_lut_func\n");
+    benchmark();
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+typedef int i2c_port_t;
+typedef struct i2c_master_bus_t *i2c_master_bus_handle_t;
+typedef struct i2c_master_dev_t *i2c_master_dev_handle_t;
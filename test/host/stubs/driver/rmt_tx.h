@@ -0,0 +1,3 @@
+#pragma once
+
+#include "hal/rmt_ll.h"
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef struct async_memcpy_context_t *async_memcpy_handle_t;
+typedef struct {
+    void *data;
+} async_memcpy_event_t;
+typedef bool (*async_memcpy_isr_cb_t)(async_memcpy_handle_t, async_memcpy_event_t *, void *);
+
+esp_err_t esp_async_memcpy(async_memcpy_handle_t handle, void *dst, void *src, size_t n, async_memcpy_isr_cb_t cb, void *args);
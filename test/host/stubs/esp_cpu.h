@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_rom_sys.h"
+
+uint32_t esp_cpu_get_cycle_count(void);
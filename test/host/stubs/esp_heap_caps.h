@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MALLOC_CAP_8BIT 0
+#define MALLOC_CAP_SPIRAM 0
+#define MALLOC_CAP_INTERNAL 0
+#define MALLOC_CAP_DMA 0
+
+#define heap_caps_malloc(size, caps) malloc(size)
+#define heap_caps_calloc(n, size, caps) calloc(n, size)
+#define heap_caps_free(ptr) free(ptr)
+
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, int caps) {
+    void *ptr = NULL;
+    // posix_memalign() needs at least pointer alignment
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *);
+    }
+    return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+}
+
+static inline void *heap_caps_aligned_calloc(size_t alignment, size_t n, size_t size, int caps) {
+    void *ptr = heap_caps_aligned_alloc(alignment, n * size, caps);
+    if (ptr != NULL) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
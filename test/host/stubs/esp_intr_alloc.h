@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ESP_INTR_FLAG_LOWMED (1 << 1)
+#define ESP_INTR_FLAG_SHARED (1 << 8)
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+#define ESP_INTR_FLAG_INTRDISABLED (1 << 11)
+
+typedef void (*intr_handler_t)(void *arg);
+typedef struct intr_handle_data_t *intr_handle_t;
+
+// the LCD simulation of the test calls the handlers
+esp_err_t esp_intr_alloc_intrstatus(int source, int flags, uint32_t reg, uint32_t mask,
+                                    intr_handler_t handler, void *arg, intr_handle_t *handle);
+
+static inline esp_err_t esp_intr_enable(intr_handle_t handle) {
+    return ESP_OK;
+}
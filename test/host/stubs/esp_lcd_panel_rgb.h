@@ -0,0 +1,4 @@
+#pragma once
+
+#include <stdlib.h>
+#include "esp_heap_caps.h"
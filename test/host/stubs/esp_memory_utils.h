@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdbool.h>
+
+// the host has no PSRAM
+static inline bool esp_ptr_external_ram(const void *ptr) {
+    return false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/dma_types.h"
+
+typedef struct gdma_channel_t *gdma_channel_handle_t;
+
+typedef enum {
+    GDMA_CHANNEL_DIRECTION_TX,
+    GDMA_CHANNEL_DIRECTION_RX,
+} gdma_channel_direction_t;
+
+typedef struct {
+    gdma_channel_handle_t sibling_chan;
+    gdma_channel_direction_t direction;
+} gdma_channel_alloc_config_t;
+
+typedef struct {
+    int periph;
+    int instance_id;
+} gdma_trigger_t;
+
+#define GDMA_TRIG_PERIPH_LCD 1
+#define GDMA_MAKE_TRIGGER(peri, id) ((gdma_trigger_t){.periph = (peri), .instance_id = (id)})
+
+typedef struct {
+    size_t sram_trans_align;
+    size_t psram_trans_align;
+} gdma_transfer_ability_t;
+
+typedef struct {
+    intptr_t rx_eof_desc_addr;
+    intptr_t tx_eof_desc_addr;
+} gdma_event_data_t;
+
+typedef bool (*gdma_event_callback_t)(gdma_channel_handle_t chan, gdma_event_data_t *event, void *user_data);
+
+typedef struct {
+    gdma_event_callback_t on_trans_eof;
+    gdma_event_callback_t on_descr_err;
+} gdma_tx_event_callbacks_t;
+
+// the LCD simulation of the test follows the descriptors and calls the callbacks
+esp_err_t gdma_register_tx_event_callbacks(gdma_channel_handle_t chan, gdma_tx_event_callbacks_t *cbs, void *user_data);
+esp_err_t gdma_start(gdma_channel_handle_t chan, intptr_t desc_base_addr);
+
+static inline esp_err_t gdma_new_channel(const gdma_channel_alloc_config_t *config, gdma_channel_handle_t *chan) {
+    *chan = NULL;
+    return ESP_OK;
+}
+
+static inline esp_err_t gdma_connect(gdma_channel_handle_t chan, gdma_trigger_t trigger) {
+    return ESP_OK;
+}
+
+static inline esp_err_t gdma_set_transfer_ability(gdma_channel_handle_t chan, const gdma_transfer_ability_t *ability) {
+    return ESP_OK;
+}
+
+static inline esp_err_t gdma_reset(gdma_channel_handle_t chan) {
+    return ESP_OK;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+static inline void periph_module_enable(int module) {}
+static inline void periph_module_reset(int module) {}
@@ -0,0 +1,167 @@
+// FreeRTOS tasks, semaphores and notifications on POSIX threads,
+// plus the timing functions of ESP-IDF used by the output drivers.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_async_memcpy.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned count;
+    // 1 for binary semaphores, the notification count of a task is unlimited
+    unsigned max_count;
+};
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t function;
+    void *arg;
+    struct host_semaphore notify;
+};
+
+static __thread TaskHandle_t current_task = NULL;
+
+static void semaphore_init(struct host_semaphore *semaphore, unsigned max_count) {
+    pthread_mutex_init(&semaphore->lock, NULL);
+    pthread_cond_init(&semaphore->cond, NULL);
+    semaphore->count = 0;
+    semaphore->max_count = max_count;
+}
+
+static void semaphore_give(struct host_semaphore *semaphore) {
+    pthread_mutex_lock(&semaphore->lock);
+    if (semaphore->count < semaphore->max_count) {
+        semaphore->count++;
+    }
+    pthread_cond_signal(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->lock);
+}
+
+/// Wait until given, `portMAX_DELAY` waits forever, other timeouts are in ms.
+static unsigned semaphore_take(struct host_semaphore *semaphore, TickType_t ticks, bool clear) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks / 1000;
+    deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&semaphore->lock);
+    while (semaphore->count == 0) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&semaphore->cond, &semaphore->lock);
+        } else if (ticks == 0 || pthread_cond_timedwait(&semaphore->cond, &semaphore->lock, &deadline) != 0) {
+            break;
+        }
+    }
+    unsigned count = semaphore->count;
+    if (count > 0) {
+        semaphore->count = clear ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&semaphore->lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    SemaphoreHandle_t semaphore = malloc(sizeof(struct host_semaphore));
+    semaphore_init(semaphore, 1);
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    return semaphore_take(semaphore, ticks, false) > 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    semaphore_give(semaphore);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *task_awoken) {
+    semaphore_give(semaphore);
+    return pdTRUE;
+}
+
+static void *task_main(void *arg) {
+    current_task = arg;
+    current_task->function(current_task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    TaskHandle_t task = calloc(1, sizeof(struct host_task));
+    task->function = function;
+    task->arg = arg;
+    semaphore_init(&task->notify, ~0u);
+    if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+        free(task);
+        return pdFALSE;
+    }
+    pthread_detach(task->thread);
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    semaphore_give(&task->notify);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    return semaphore_take(&current_task->notify, ticks, clear);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        sched_yield();
+    } else {
+        esp_rom_delay_us(ticks * 1000);
+    }
+}
+
+BaseType_t xPortGetCoreID(void) {
+    return 0;
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void esp_rom_delay_us(uint32_t us) {
+    struct timespec delay = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (long)(us % 1000000) * 1000,
+    };
+    nanosleep(&delay, NULL);
+}
+
+uint32_t esp_cpu_get_cycle_count(void) {
+    // one cycle per ns is close enough for the statistics
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000000ull + now.tv_nsec);
+}
+
+esp_err_t esp_async_memcpy(async_memcpy_handle_t handle, void *dst, void *src, size_t n,
+                           async_memcpy_isr_cb_t cb, void *args) {
+    // no copy engine, framebuffer rows are read in place
+    return ESP_FAIL;
+}
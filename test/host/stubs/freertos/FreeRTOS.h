@@ -0,0 +1,31 @@
+#pragma once
+
+// FreeRTOS on POSIX threads, see esp_rtos.c. Only what the tested sources use.
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef struct host_task *TaskHandle_t;
+typedef struct host_semaphore *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define portYIELD_FROM_ISR(...) do {} while (0)
+// interrupts are called from the simulation thread, nothing to mask
+#define taskENTER_CRITICAL(mux) ((void)(mux))
+#define taskEXIT_CRITICAL(mux) ((void)(mux))
+
+BaseType_t xPortGetCoreID(void);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct dma_descriptor_s dma_descriptor_t;
+struct dma_descriptor_s {
+    struct {
+        uint32_t size : 12;
+        uint32_t length : 12;
+        uint32_t reserved24 : 4;
+        uint32_t err_eof : 1;
+        uint32_t reserved29 : 1;
+        uint32_t suc_eof : 1;
+        uint32_t owner : 1;
+    } dw0;
+    void *buffer;
+    dma_descriptor_t *next;
+};
+
+#define DMA_DESCRIPTOR_BUFFER_OWNER_CPU 0
+#define DMA_DESCRIPTOR_BUFFER_OWNER_DMA 1
+#define DMA_DESCRIPTOR_BUFFER_MAX_SIZE 4095
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+static inline void gpio_hal_iomux_func_sel(uint32_t reg, uint32_t func) {
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include "hal/lcd_ll.h"
+#include "esp_intr_alloc.h"
+
+typedef struct {
+    lcd_cam_dev_t *dev;
+} lcd_hal_context_t;
+
+static inline void lcd_hal_init(lcd_hal_context_t *hal, int id) {
+    static lcd_cam_dev_t dev;
+    hal->dev = &dev;
+}
+
+static inline uint32_t lcd_hal_cal_pclk_freq(lcd_hal_context_t *hal, uint32_t src_freq_hz, uint32_t expect_pclk_freq_hz, int lcd_clk_flags) {
+    return expect_pclk_freq_hz;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Register accesses of the LCD peripheral. The ones that move the output
+// are implemented by the LCD simulation of the test, the others do nothing.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int unused;
+} lcd_cam_dev_t;
+
+#define LCD_LL_EVENT_VSYNC_END (1 << 0)
+#define LCD_LL_EVENT_TRANS_DONE (1 << 1)
+#define LCD_CLK_SRC_PLL240M 1
+
+void lcd_ll_start(lcd_cam_dev_t *dev);
+void lcd_ll_stop(lcd_cam_dev_t *dev);
+void lcd_ll_set_vertical_timing(lcd_cam_dev_t *dev, uint32_t vsw, uint32_t vbp, uint32_t active_height, uint32_t vfp);
+void lcd_ll_enable_auto_next_frame(lcd_cam_dev_t *dev, bool enable);
+uint32_t lcd_ll_get_interrupt_status(lcd_cam_dev_t *dev);
+void lcd_ll_clear_interrupt_status(lcd_cam_dev_t *dev, uint32_t mask);
+
+static inline volatile void *lcd_ll_get_interrupt_status_reg(lcd_cam_dev_t *dev) { return NULL; }
+static inline void lcd_ll_fifo_reset(lcd_cam_dev_t *dev) {}
+static inline void lcd_ll_reset(lcd_cam_dev_t *dev) {}
+static inline void lcd_ll_set_horizontal_timing(lcd_cam_dev_t *dev, uint32_t hsw, uint32_t hbp,
+                                                uint32_t active_width, uint32_t hfp) {}
+static inline void lcd_ll_set_hsync_position(lcd_cam_dev_t *dev, uint32_t offset) {}
+static inline void lcd_ll_enable_clock(lcd_cam_dev_t *dev, bool enable) {}
+static inline void lcd_ll_select_clk_src(lcd_cam_dev_t *dev, int src) {}
+static inline void lcd_ll_set_clock_idle_level(lcd_cam_dev_t *dev, bool level) {}
+static inline void lcd_ll_set_pixel_clock_edge(lcd_cam_dev_t *dev, bool active_on_neg) {}
+static inline void lcd_ll_enable_rgb_mode(lcd_cam_dev_t *dev, bool enable) {}
+static inline void lcd_ll_set_data_width(lcd_cam_dev_t *dev, uint32_t width) {}
+static inline void lcd_ll_set_phase_cycles(lcd_cam_dev_t *dev, uint32_t cmd, uint32_t dummy, uint32_t data) {}
+static inline void lcd_ll_enable_output_hsync_in_porch_region(lcd_cam_dev_t *dev, bool enable) {}
+static inline void lcd_ll_enable_output_always_on(lcd_cam_dev_t *dev, bool enable) {}
+static inline void lcd_ll_set_idle_level(lcd_cam_dev_t *dev, bool hsync, bool vsync, bool de) {}
+static inline void lcd_ll_set_blank_cycles(lcd_cam_dev_t *dev, uint32_t front, uint32_t back) {}
+static inline void lcd_ll_enable_interrupt(lcd_cam_dev_t *dev, uint32_t mask, bool enable) {}
@@ -0,0 +1,59 @@
+#pragma once
+
+// The CKV signal is not simulated, all RMT accesses do nothing.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int unused;
+} rmt_dev_t;
+
+typedef union {
+    struct {
+        uint32_t duration0 : 15;
+        uint32_t level0 : 1;
+        uint32_t duration1 : 15;
+        uint32_t level1 : 1;
+    };
+    uint32_t val;
+} rmt_item32_t;
+
+typedef struct {
+    struct {
+        volatile rmt_item32_t data32[48];
+    } chan[8];
+} rmt_mem_t;
+
+typedef enum {
+    RMT_CHANNEL_0,
+    RMT_CHANNEL_1,
+    RMT_CHANNEL_2,
+    RMT_CHANNEL_3,
+} rmt_channel_t;
+
+typedef enum {
+    RMT_IDLE_LEVEL_LOW,
+    RMT_IDLE_LEVEL_HIGH,
+} rmt_idle_level_t;
+
+typedef int rmt_clock_source_t;
+#define RMT_BASECLK_DEFAULT 1
+
+extern rmt_dev_t RMT;
+
+static inline void rmt_ll_tx_enable_loop_count(rmt_dev_t *dev, int channel, bool enable) {}
+static inline void rmt_ll_tx_enable_loop_autostop(rmt_dev_t *dev, int channel, bool enable) {}
+static inline void rmt_ll_tx_set_loop_count(rmt_dev_t *dev, int channel, uint32_t count) {}
+static inline void rmt_ll_tx_reset_pointer(rmt_dev_t *dev, int channel) {}
+static inline void rmt_ll_tx_start(rmt_dev_t *dev, int channel) {}
+static inline void rmt_ll_tx_stop(rmt_dev_t *dev, int channel) {}
+static inline void rmt_ll_enable_periph_clock(rmt_dev_t *dev, bool enable) {}
+static inline void rmt_ll_set_group_clock_src(rmt_dev_t *dev, int channel, rmt_clock_source_t src,
+                                              uint32_t div, uint32_t num, uint32_t den) {}
+static inline void rmt_ll_tx_set_channel_clock_div(rmt_dev_t *dev, int channel, uint32_t div) {}
+static inline void rmt_ll_tx_set_mem_blocks(rmt_dev_t *dev, int channel, uint8_t blocks) {}
+static inline void rmt_ll_enable_mem_access_nonfifo(rmt_dev_t *dev, bool enable) {}
+static inline void rmt_ll_tx_fix_idle_level(rmt_dev_t *dev, int channel, uint8_t level, bool enable) {}
+static inline void rmt_ll_tx_enable_carrier_modulation(rmt_dev_t *dev, int channel, bool enable) {}
+static inline void rmt_ll_tx_enable_loop(rmt_dev_t *dev, int channel, bool enable) {}
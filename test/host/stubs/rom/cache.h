@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+static inline void Cache_Start_DCache_Preload(uint32_t addr, uint32_t size, uint32_t order) {
+}
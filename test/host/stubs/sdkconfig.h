@@ -0,0 +1,4 @@
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE 64
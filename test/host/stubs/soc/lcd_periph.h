@@ -0,0 +1,15 @@
+#pragma once
+
+typedef struct {
+    struct {
+        int module;
+        int irq_id;
+        int data_sigs[24];
+        int hsync_sig;
+        int vsync_sig;
+        int pclk_sig;
+        int de_sig;
+    } panels[1];
+} lcd_signal_conn_t;
+
+extern const lcd_signal_conn_t lcd_periph_signals;
@@ -0,0 +1,14 @@
+#pragma once
+
+typedef struct {
+    struct {
+        int module;
+        int irq;
+        struct {
+            int tx_sig;
+            int rx_sig;
+        } channels[8];
+    } groups[1];
+} rmt_signal_conn_t;
+
+extern const rmt_signal_conn_t rmt_periph_signals;